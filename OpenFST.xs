@@ -12,8 +12,90 @@ extern "C" {
 #undef Move
 #include "openfst-pre.h"
 #include "openfst.h"
+#include "lexicon.h"
 #include "const-c.inc"
 
+/* Whether SV is a temporary, such as the result of the previous call
+   in a chain, holding the only reference to its FST.  Such an FST can
+   be changed in place instead of copied.  Only XSUBs see SvTEMP on
+   their arguments (calling a Perl sub clears it), so this must be
+   asked of the XSUB's own ST(0), never through a Perl wrapper. */
+static bool
+stealable(pTHX_ SV * sv)
+{
+    return SvTEMP(sv) && SvROK(sv) && SvREFCNT(sv) == 1
+        && SvREFCNT(SvRV(sv)) == 1;
+}
+
+/* The FST a non-destructive method should change: FST itself if *SV
+   is stealable, otherwise a copy, which replaces *SV as the result. */
+static FST *
+own(pTHX_ SV ** sv, FST * fst)
+{
+    if (stealable(aTHX_ *sv))
+        return fst;
+    fst = fst->Copy();
+    *sv = sv_newmortal();
+    sv_setref_pv(*sv, "Algorithm::OpenFST::FST", (void *)fst);
+    return fst;
+}
+
+/* A new arrayref of LABELS, as symbols if there is a table. */
+static SV *
+labels_ref(pTHX_ const vector<int>& labels, SymbolTable * syms)
+{
+    AV * av = newAV();
+    for (size_t i = 0; i < labels.size(); i++) {
+        if (syms) {
+            string s = syms->Find(labels[i]);
+            av_push(av, newSVpvn(s.c_str(), s.size()));
+        } else {
+            av_push(av, newSViv(labels[i]));
+        }
+    }
+    return newRV_noinc((SV *)av);
+}
+
+/* The labels of INPUT's symbols, or INPUT itself if there is no
+   table.  Croaks on a symbol the table does not have. */
+static void
+input_labels(pTHX_ AV * input, SymbolTable * syms, vector<int>& out)
+{
+    for (int i = 0; i <= av_len(input); i++) {
+        SV ** sv = av_fetch(input, i, 0);
+        if (!sv)
+            continue;
+        if (!syms) {
+            out.push_back(SvIV(*sv));
+            continue;
+        }
+        const char * s = SvPV_nolen(*sv);
+        int64 l = syms->Find(s);
+        if (l < 0)
+            croak("unknown input symbol '%s'", s);
+        out.push_back(l);
+    }
+}
+
+/* A new hashref of ST's fields. */
+static SV *
+det_stats_ref(pTHX_ const det_stats& st)
+{
+    HV * hv = newHV();
+    hv_store(hv, "states", 6, newSViv(st.states), 0);
+    hv_store(hv, "arcs", 4, newSViv(st.arcs), 0);
+    hv_store(hv, "max_subset", 10, newSViv(st.max_subset), 0);
+    hv_store(hv, "mean_subset", 11, newSVnv(st.mean_subset), 0);
+    hv_store(hv, "collision_rate", 14, newSVnv(st.collision_rate), 0);
+    hv_store(hv, "seconds", 7, newSVnv(st.seconds), 0);
+    hv_store(hv, "states_per_second", 17, newSVnv(st.states_per_second), 0);
+    hv_store(hv, "coverage", 8, newSViv(st.coverage), 0);
+    hv_store(hv, "growth", 6, newSVnv(st.growth), 0);
+    hv_store(hv, "predicted_states", 16, newSVnv(st.predicted_states), 0);
+    hv_store(hv, "complete", 8, newSViv(st.complete), 0);
+    return newRV_noinc((SV *)hv);
+}
+
 MODULE = Algorithm::OpenFST	PACKAGE = Algorithm::OpenFST
 PROTOTYPES: DISABLE
 
@@ -52,6 +134,102 @@ Transducer(f, smr=1, is=0, os=0, ss=0)
 	const char * os
 	const char * ss
 
+void
+cache_size(n)
+	int	n
+
+void
+cache_stats()
+    PREINIT:
+	unsigned long hits, misses, entries, size;
+    PPCODE:
+	cache_stats(hits, misses, entries, size);
+	EXTEND(SP, 8);
+	PUSHs(sv_2mortal(newSVpv("hits", 0)));
+	PUSHs(sv_2mortal(newSVuv(hits)));
+	PUSHs(sv_2mortal(newSVpv("misses", 0)));
+	PUSHs(sv_2mortal(newSVuv(misses)));
+	PUSHs(sv_2mortal(newSVpv("entries", 0)));
+	PUSHs(sv_2mortal(newSVuv(entries)));
+	PUSHs(sv_2mortal(newSVpv("size", 0)));
+	PUSHs(sv_2mortal(newSVuv(size)));
+
+unsigned long
+copy_count()
+
+void
+concat(first, ...)
+	FST *	first
+    ALIAS:
+	union = 1
+    PPCODE:
+	FST * ret = own(aTHX_ &ST(0), first);
+	for (int i = 1; i < items; i++) {
+	    if (!sv_isobject(ST(i)))
+	        croak("%s: argument %d is not an FST",
+	              ix ? "union" : "concat", i);
+	    FST * f = (FST *)SvIV(SvRV(ST(i)));
+	    if (ix)
+	        ret->_Union(f);
+	    else
+	        ret->_Concat(f);
+	}
+	XSRETURN(1);
+
+void
+_compose_batch(big, small, threads = 1, nbest = 0)
+	FST *	big
+	AV *	small
+	int	threads
+	unsigned	nbest
+    PREINIT:
+	vector<FST *> in, out;
+    PPCODE:
+	for (int i = 0; i <= av_len(small); i++) {
+	    SV ** sv = av_fetch(small, i, 0);
+	    if (!sv || !sv_isobject(*sv))
+	        croak("compose_batch: element %d is not an FST", i);
+	    in.push_back((FST *)SvIV(SvRV(*sv)));
+	}
+	big->compose_batch(in, threads, nbest, out);
+	EXTEND(SP, out.size());
+	for (size_t i = 0; i < out.size(); i++) {
+	    SV * sv = sv_newmortal();
+	    sv_setref_pv(sv, "Algorithm::OpenFST::FST", (void *)out[i]);
+	    PUSHs(sv);
+	}
+
+void
+_decode_batch(fst, seqs, threads = 1, nbest = 1)
+	FST *	fst
+	AV *	seqs
+	int	threads
+	unsigned	nbest
+    PREINIT:
+	vector<vector<int> > in;
+	vector<vector<pair<vector<int>, float> > > out;
+    PPCODE:
+	SymbolTable * isyms = fst->InputSymbols();
+	in.resize(av_len(seqs) + 1);
+	for (int i = 0; i <= av_len(seqs); i++) {
+	    SV ** sv = av_fetch(seqs, i, 0);
+	    if (!sv || !SvROK(*sv) || SvTYPE(SvRV(*sv)) != SVt_PVAV)
+	        croak("decode_batch: element %d is not an array", i);
+	    input_labels(aTHX_ (AV *)SvRV(*sv), isyms, in[i]);
+	}
+	fst->transduce_batch(in, nbest, threads, out);
+	EXTEND(SP, out.size());
+	for (size_t i = 0; i < out.size(); i++) {
+	    AV * r = newAV();
+	    for (size_t j = 0; j < out[i].size(); j++) {
+	        AV * o = newAV();
+	        av_push(o, labels_ref(aTHX_ out[i][j].first, fst->OutputSymbols()));
+	        av_push(o, newSVnv(out[i][j].second));
+	        av_push(r, newRV_noinc((SV *)o));
+	    }
+	    PUSHs(sv_2mortal(newRV_noinc((SV *)r)));
+	}
+
 MODULE = Algorithm::OpenFST	PACKAGE = Algorithm::OpenFST::FST
 PROTOTYPES: DISABLE
 
@@ -77,45 +255,196 @@ void
 FST::_Union(fst)
 	FST *	fst
 
+void
+FST::Union(fst)
+	FST *	fst
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Union(fst);
+	XSRETURN(1);
+
 void
 FST::_Concat(fst)
 	FST *	fst
 
+void
+FST::Concat(fst)
+	FST *	fst
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Concat(fst);
+	XSRETURN(1);
+
 void
 FST::_Closure(n)
 	int	n
 
+void
+FST::Closure(n)
+	int	n
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Closure(n);
+	XSRETURN(1);
+
 void
 FST::_Project(n)
 	int	n
 
+void
+FST::Project(n)
+	int	n
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Project(n);
+	XSRETURN(1);
+
 FST *
-FST::Reverse()
+FST::Reverse(lazy = 0)
+	bool	lazy
 
 void
 FST::_Invert()
 
+void
+FST::Invert()
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Invert();
+	XSRETURN(1);
+
+void
+FST::_ArcSort(type = 1)
+	int	type
+
+void
+FST::ArcSort(type = 1)
+	int	type
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_ArcSort(type);
+	XSRETURN(1);
+
+void
+FST::_RmWeight()
+
+void
+FST::RmWeight()
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_RmWeight();
+	XSRETURN(1);
+
 FST *
-FST::Determinize(del = 1.024e-3)
+FST::Determinize(del = 1.024e-3, max_states = 0, max_arcs = 0, threshold = -1)
 	float	del
+	int	max_states
+	int	max_arcs
+	float	threshold
 
 void
-FST::_RmEpsilon(del = 1.024e-3)
+FST::_determinize_stats(del, max_states, max_arcs, threshold)
 	float	del
+	int	max_states
+	int	max_arcs
+	float	threshold
+    PREINIT:
+	det_stats st;
+    PPCODE:
+	FST * ret = THIS->Determinize(del, max_states, max_arcs, threshold, &st);
+	EXTEND(SP, 2);
+	PUSHs(sv_newmortal());
+	sv_setref_pv(ST(0), "Algorithm::OpenFST::FST", (void *)ret);
+	PUSHs(sv_2mortal(det_stats_ref(aTHX_ st)));
+
+SV *
+FST::_determinize_estimate(del, sample)
+	float	del
+	int	sample
+    PREINIT:
+	det_stats st;
+    CODE:
+	THIS->determinize_estimate(del, sample, st);
+	RETVAL = det_stats_ref(aTHX_ st);
+    OUTPUT:
+	RETVAL
 
 void
-FST::_Minimize()
+FST::_RmEpsilon(del = 1.024e-3, threads = 1)
+	float	del
+	int	threads
 
-FST *
-FST::Minimize()
+void
+FST::RmEpsilon(del = 1.024e-3, threads = 1)
+	float	del
+	int	threads
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_RmEpsilon(del, threads);
+	XSRETURN(1);
+
+void
+FST::_Minimize(threads = 1, general = 0)
+	int	threads
+	bool	general
+
+void
+FST::Minimize(threads = 1)
+	int	threads
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Minimize(threads);
+	XSRETURN(1);
+
+void
+FST::_optimize(delta, threads, sort)
+	float	delta
+	int	threads
+	int	sort
+    PREINIT:
+	vector<stage_stats> stats;
+    PPCODE:
+	FST * ret = THIS->optimize(delta, threads, sort, stats);
+	EXTEND(SP, 1 + stats.size());
+	PUSHs(sv_newmortal());
+	sv_setref_pv(ST(0), "Algorithm::OpenFST::FST", (void *)ret);
+	for (size_t i = 0; i < stats.size(); i++) {
+	    HV * hv = newHV();
+	    hv_store(hv, "stage", 5, newSVpv(stats[i].stage, 0), 0);
+	    hv_store(hv, "seconds", 7, newSVnv(stats[i].seconds), 0);
+	    hv_store(hv, "states", 6, newSViv(stats[i].states), 0);
+	    hv_store(hv, "arcs", 4, newSViv(stats[i].arcs), 0);
+	    PUSHs(sv_2mortal(newRV_noinc((SV *)hv)));
+	}
 
 void
-FST::_Prune(w)
+FST::_Prune(w, threads = 1)
 	float	w
+	int	threads
 
 void
-FST::_Push(i)
+FST::Prune(w, threads = 1)
+	float	w
+	int	threads
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Prune(w, threads);
+	XSRETURN(1);
+
+void
+FST::_Push(i, threads = 1)
 	int	i
+	int	threads
+
+void
+FST::Push(i, threads = 1)
+	int	i
+	int	threads
+    PPCODE:
+	own(aTHX_ &ST(0), THIS)->_Push(i, threads);
+	XSRETURN(1);
+
+void
+FST::_distances(reverse, threads = 1)
+	bool	reverse
+	int	threads
+    PREINIT:
+	vector<float> d;
+    PPCODE:
+	THIS->distances(reverse, d, threads);
+	EXTEND(SP, d.size());
+	for (size_t i = 0; i < d.size(); i++)
+	    PUSHs(sv_2mortal(newSVnv(d[i])));
 
 void
 FST::AddState()
@@ -169,10 +498,76 @@ unsigned
 FST::Properties(compute = 0)
 	int	compute
 
+void
+FST::_transduce(input, n = 1)
+	AV *	input
+	unsigned	n
+    PREINIT:
+	vector<int> in;
+	vector<pair<vector<int>, float> > out;
+    PPCODE:
+	input_labels(aTHX_ input, THIS->InputSymbols(), in);
+	THIS->transduce(in, n, out);
+	EXTEND(SP, out.size());
+	for (size_t i = 0; i < out.size(); i++) {
+	    AV * r = newAV();
+	    av_push(r, labels_ref(aTHX_ out[i].first, THIS->OutputSymbols()));
+	    av_push(r, newSVnv(out[i].second));
+	    PUSHs(sv_2mortal(newRV_noinc((SV *)r)));
+	}
+
+SV *
+FST::posteriors()
+    PREINIT:
+	vector<float> post;
+    CODE:
+	THIS->posteriors(post);
+	RETVAL = newSVpvn(post.empty() ? "" : (const char *)&post[0],
+	                  post.size() * sizeof(float));
+    OUTPUT:
+	RETVAL
+
+void
+FST::_beam_search(input, beam, max_active)
+	AV *	input
+	float	beam
+	unsigned	max_active
+    PREINIT:
+	vector<int> in, out;
+	float cost;
+	decode_stats st;
+    PPCODE:
+	input_labels(aTHX_ input, THIS->InputSymbols(), in);
+	bool found = THIS->beam_search(in, beam, max_active, out, cost, &st);
+	HV * hv = newHV();
+	hv_store(hv, "created", 7, newSViv(st.created), 0);
+	hv_store(hv, "pruned", 6, newSViv(st.pruned), 0);
+	hv_store(hv, "expanded", 8, newSViv(st.expanded), 0);
+	hv_store(hv, "pool", 4, newSViv(st.pool), 0);
+	EXTEND(SP, 3);
+	if (found) {
+	    PUSHs(sv_2mortal(labels_ref(aTHX_ out, THIS->OutputSymbols())));
+	    PUSHs(sv_2mortal(newSVnv(cost)));
+	} else {
+	    PUSHs(&PL_sv_undef);
+	    PUSHs(&PL_sv_undef);
+	}
+	PUSHs(sv_2mortal(newRV_noinc((SV *)hv)));
+
+PathIterator *
+FST::_paths(unique)
+	bool	unique
+    CODE:
+	RETVAL = THIS->paths(unique);
+    OUTPUT:
+	RETVAL
+
 FST *
-FST::ShortestPath(n = 1, uniq = 0)
+FST::ShortestPath(n = 1, uniq = 0, astar = 0, threads = 1)
 	unsigned	n
 	int	uniq
+	bool	astar
+	int	threads
 
 void
 FST::normalize()
@@ -188,16 +583,16 @@ FST::change_semiring(smr)
 int
 FST::semiring()
 
-void
-FST::strings()
-    PREINIT:
-      vector<string> tmp;
-    PPCODE:
-      THIS->strings(tmp);
-      EXTEND(SP, tmp.size());
-      for (int i = 0; i < tmp.size(); i++)
-          PUSHs(sv_2mortal(newSVpvn(tmp[i].c_str(), tmp[i].size())));
-      XSRETURN(tmp.size());
+StringIterator *
+FST::_string_iterator(output, max_count, max_length, cycles)
+	bool	output
+	unsigned	max_count
+	unsigned	max_length
+	bool	cycles
+    CODE:
+	RETVAL = THIS->string_iterator(output, max_count, max_length, cycles);
+    OUTPUT:
+	RETVAL
 
 int
 FST::add_input_symbol(s)
@@ -254,3 +649,96 @@ FST::in_syms()
 FST *
 FST::EpsNormalize(dir)
 	int	dir
+
+MODULE = Algorithm::OpenFST	PACKAGE = Algorithm::OpenFST::LexiconBuilder
+PROTOTYPES: DISABLE
+
+SV *
+LexiconBuilder::new(smr = SMRLog)
+	int	smr
+    CODE:
+	RETVAL = sv_setref_pv(newSV(0), CLASS,
+	                      (void *)new LexiconBuilder(smr));
+    OUTPUT:
+	RETVAL
+
+void
+LexiconBuilder::DESTROY()
+
+bool
+LexiconBuilder::_add(word)
+	AV *	word
+    PREINIT:
+	vector<string> w;
+    CODE:
+	for (int i = 0; i <= av_len(word); i++) {
+	    SV ** sv = av_fetch(word, i, 0);
+	    w.push_back(sv ? SvPV_nolen(*sv) : "");
+	}
+	RETVAL = THIS->add(w);
+    OUTPUT:
+	RETVAL
+
+FST *
+LexiconBuilder::finish()
+
+int
+LexiconBuilder::NumStates()
+
+MODULE = Algorithm::OpenFST	PACKAGE = Algorithm::OpenFST::PathIterator
+PROTOTYPES: DISABLE
+
+void
+PathIterator::DESTROY()
+
+void
+PathIterator::next()
+    PREINIT:
+	vector<int> in, out;
+	float cost;
+    PPCODE:
+	if (!THIS->next(in, out, cost))
+	    XSRETURN_EMPTY;
+	EXTEND(SP, 3);
+	PUSHs(sv_2mortal(labels_ref(aTHX_ in, THIS->InputSymbols())));
+	PUSHs(sv_2mortal(labels_ref(aTHX_ out, THIS->OutputSymbols())));
+	PUSHs(sv_2mortal(newSVnv(cost)));
+
+MODULE = Algorithm::OpenFST	PACKAGE = Algorithm::OpenFST::StringIterator
+PROTOTYPES: DISABLE
+
+void
+StringIterator::DESTROY()
+
+bool
+StringIterator::truncated()
+
+void
+StringIterator::_next(n, sep)
+	unsigned	n
+	SV *	sep
+    PREINIT:
+	vector<int> labels;
+	string buf;
+    PPCODE:
+	SymbolTable * syms = THIS->Symbols();
+	for (unsigned i = 0; i < n && THIS->next(labels); i++) {
+	    if (!SvOK(sep)) {
+	        XPUSHs(sv_2mortal(labels_ref(aTHX_ labels, syms)));
+	        continue;
+	    }
+	    /* Reuse one buffer for the strings. */
+	    buf.clear();
+	    for (size_t j = 0; j < labels.size(); j++) {
+	        if (j)
+	            buf += SvPV_nolen(sep);
+	        if (syms) {
+	            buf += syms->Find(labels[j]);
+	        } else {
+	            char num[24];
+	            sprintf(num, "%d", labels[j]);
+	            buf += num;
+	        }
+	    }
+	    XPUSHs(sv_2mortal(newSVpvn(buf.data(), buf.size())));
+	}
@@ -0,0 +1,190 @@
+#ifndef _acyclic_minimize_h
+#define _acyclic_minimize_h
+
+// Revuz's linear-time minimization of acyclic automata.  A state's
+// height is the length of the longest path from it to a state with
+// no arcs; equivalent states have equal heights, so processing the
+// heights bottom-up, each state only needs comparing with the states
+// of its own height, whose targets have all been merged already.
+// Works in place: arcs are redirected to the surviving states and the
+// others are deleted.  Expects a deterministic unweighted acceptor.
+
+#include <algorithm>
+#include <vector>
+#include "refine.h"
+using namespace std;
+using namespace fst;
+
+template <class Arc>
+class AcyclicMinimizer
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Weight Weight;
+
+    explicit AcyclicMinimizer(MutableFst<Arc> * fst)
+        : fst_(fst) { }
+
+    void run();
+
+private:
+    void heights();
+    uint64 signature(StateId s);
+    bool same(StateId a, StateId b);
+
+    MutableFst<Arc> * fst_;
+    vector<StateId> height;
+    vector<StateId> repr;           // surviving equivalent state
+};
+
+/// Heights by iterative depth-first search.
+template <class Arc>
+void
+AcyclicMinimizer<Arc>::heights()
+{
+    StateId n = fst_->NumStates();
+    height.assign(n, -1);
+    vector<pair<StateId, size_t> > stack;
+    for (StateId root = 0; root < n; root++) {
+        if (height[root] >= 0)
+            continue;
+        stack.push_back(make_pair(root, (size_t)0));
+        height[root] = 0;
+        while (!stack.empty()) {
+            StateId s = stack.back().first;
+            size_t i = stack.back().second;
+            ArcIterator<MutableFst<Arc> > ai(*fst_, s);
+            ai.Seek(i);
+            if (ai.Done()) {
+                stack.pop_back();
+                if (!stack.empty()) {
+                    StateId p = stack.back().first;
+                    if (height[p] < height[s] + 1)
+                        height[p] = height[s] + 1;
+                }
+                continue;
+            }
+            stack.back().second++;
+            StateId d = ai.Value().nextstate;
+            if (height[d] < 0) {
+                height[d] = 0;
+                stack.push_back(make_pair(d, (size_t)0));
+            } else if (height[s] < height[d] + 1) {
+                height[s] = height[d] + 1;
+            }
+        }
+    }
+}
+
+template <class Arc>
+uint64
+AcyclicMinimizer<Arc>::signature(StateId s)
+{
+    uint64 h = float_bits(fst_->Final(s).Value());
+    for (ArcIterator<MutableFst<Arc> > ai(*fst_, s); !ai.Done(); ai.Next())
+        h = hash_mix(hash_mix(h, ai.Value().ilabel),
+                     repr[ai.Value().nextstate]);
+    return h;
+}
+
+template <class Arc>
+bool
+AcyclicMinimizer<Arc>::same(StateId a, StateId b)
+{
+    if (fst_->Final(a) != fst_->Final(b)
+        || fst_->NumArcs(a) != fst_->NumArcs(b))
+        return false;
+    ArcIterator<MutableFst<Arc> > i(*fst_, a), j(*fst_, b);
+    for (; !i.Done(); i.Next(), j.Next())
+        if (i.Value().ilabel != j.Value().ilabel
+            || repr[i.Value().nextstate] != repr[j.Value().nextstate])
+            return false;
+    return true;
+}
+
+template <class Arc>
+void
+AcyclicMinimizer<Arc>::run()
+{
+    StateId n = fst_->NumStates();
+    if (n == 0)
+        return;
+    ArcSort(fst_, ILabelCompare<Arc>());
+    heights();
+
+    // Bucket states by height.
+    StateId maxh = *max_element(height.begin(), height.end());
+    vector<StateId> off(maxh + 2, 0), order(n);
+    for (StateId s = 0; s < n; s++)
+        off[height[s] + 1]++;
+    for (StateId h = 0; h <= maxh; h++)
+        off[h + 1] += off[h];
+    {
+        vector<StateId> pos(off.begin(), off.end() - 1);
+        for (StateId s = 0; s < n; s++)
+            order[pos[height[s]]++] = s;
+    }
+    vector<StateId>().swap(height);
+
+    repr.resize(n);
+    vector<uint64> hash(n);
+    vector<StateId> heads, chain(n);
+    for (StateId h = 0; h <= maxh; h++) {
+        StateId lo = off[h], hi = off[h + 1];
+        size_t nb = 16;
+        while (nb < 2 * (size_t)(hi - lo))
+            nb *= 2;
+        heads.assign(nb, -1);
+        for (StateId i = lo; i < hi; i++) {
+            StateId s = order[i];
+            hash[s] = signature(s);
+            size_t b = hash[s] & (nb - 1);
+            StateId r = heads[b];
+            for (; r >= 0; r = chain[r])
+                if (hash[r] == hash[s] && same(r, s))
+                    break;
+            if (r < 0) {
+                chain[s] = heads[b];
+                heads[b] = s;
+                repr[s] = s;
+            } else {
+                repr[s] = r;
+            }
+        }
+    }
+
+    // Redirect the survivors' arcs and drop everything else.
+    vector<StateId> dead;
+    for (StateId s = 0; s < n; s++) {
+        if (repr[s] != s) {
+            dead.push_back(s);
+            continue;
+        }
+        for (MutableArcIterator<MutableFst<Arc> > ai(fst_, s);
+             !ai.Done(); ai.Next()) {
+            Arc a = ai.Value();
+            if (repr[a.nextstate] != a.nextstate) {
+                a.nextstate = repr[a.nextstate];
+                ai.SetValue(a);
+            }
+        }
+    }
+    if (fst_->Start() != kNoStateId)
+        fst_->SetStart(repr[fst_->Start()]);
+    fst_->DeleteStates(dead);
+}
+
+/// Minimize acyclic FST in place, encoding FLAGS as for
+/// parallel_minimize().
+template <class Arc>
+void
+acyclic_minimize(MutableFst<Arc> * fst,
+                 uint32 flags = ENCODE_LABEL | ENCODE_WEIGHT)
+{
+    EncodeMapper<Arc> enc(flags, ENCODE);
+    minimize_prepare(fst, &enc);
+    AcyclicMinimizer<Arc>(fst).run();
+    Decode(fst, enc);
+}
+
+#endif // _acyclic_minimize_h
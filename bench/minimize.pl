@@ -0,0 +1,76 @@
+#!/usr/bin/perl -w
+## Time minimization of random lexicons, e.g.
+##   perl -Mblib bench/minimize.pl 1e6 1e7 1e8
+## Each lexicon is N random lowercase words of 3-12 letters, built as
+## a trie, so it is acyclic.  Each is minimized twice: by the
+## linear-time acyclic path Minimize takes, and by fst::Minimize.
+## Words are generated into a file, sorted there by sort(1) and
+## streamed into the trie, so only the FSTs themselves are held in
+## memory; 100M words need several GB of RAM and temp space.
+use strict;
+use Algorithm::OpenFST qw(:constants);
+use Time::HiRes qw(time);
+
+@ARGV = (1e6) unless @ARGV;
+
+## Write N random words, one per line, to FILE.
+sub write_words
+{
+    my ($n, $file) = @_;
+    open my $out, '>', $file or die "$file: $!";
+    for (1..$n) {
+        print $out join('', map { chr(97 + int rand 26) } 1..3 + int rand 10),
+            "\n";
+    }
+    close $out or die "$file: $!";
+}
+
+## Write the trie of the sorted, unique words read from IN in AT&T
+## text format to FILE.
+sub write_trie
+{
+    my ($in, $file) = @_;
+    open my $out, '>', $file or die "$file: $!";
+    my ($prev, @path, $next) = ('', 0);
+    $next = 1;
+    while (my $w = <$in>) {
+        chomp $w;
+        my $common = 0;
+        $common++ while $common < length $w && $common < length $prev
+            && substr($w, $common, 1) eq substr($prev, $common, 1);
+        $#path = $common;
+        for my $i ($common .. length($w) - 1) {
+            my $l = ord(substr $w, $i, 1) - 96;
+            print $out "$path[-1]\t$next\t$l\t$l\n";
+            push @path, $next++;
+        }
+        print $out "$path[-1]\n";
+        $prev = $w;
+    }
+    close $out or die "$file: $!";
+    $next;
+}
+
+srand 1;
+for my $n (@ARGV) {
+    my ($words, $file) = ("/tmp/words-$$.txt", "/tmp/lexicon-$$.txt");
+    my $t = time;
+    write_words($n, $words);
+    local $ENV{LC_ALL} = 'C';
+    open my $sorted, '-|', 'sort', '-u', $words or die "sort: $!";
+    my $states = write_trie($sorted, $file);
+    close $sorted or die "sort failed\n";
+    unlink $words;
+    printf "%d words, %d trie states: built in %.1fs\n",
+        $n, $states, time - $t;
+    for my $general (0, 1) {
+        my $lex = Algorithm::OpenFST::ReadText($file, SMRTropical,
+                                               0, '', '', '');
+        $t = time;
+        $lex->_Minimize(1, $general);
+        printf "  %-13s minimized to %d states in %.2fs\n",
+            $general ? 'fst::Minimize' : 'acyclic', $lex->NumStates,
+            time - $t;
+    }
+    unlink $file;
+}
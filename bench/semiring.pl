@@ -0,0 +1,64 @@
+#!/usr/bin/perl -w
+## Time distances() and normalize() in the log and real semirings on
+## random lattices, e.g.
+##   perl -Mblib bench/semiring.pl 100 1000
+## Each lattice has N layers of 50 states, each state with arcs to 5
+## random states in the next layer, so it is acyclic; the real-semiring
+## copy has the same paths with probabilities for weights.
+use strict;
+use Algorithm::OpenFST qw(:constants);
+use Time::HiRes qw(time);
+
+@ARGV = (100) unless @ARGV;
+my ($WIDTH, $FANOUT, $REPS) = (50, 5, 20);
+
+## Write an N-layer lattice in AT&T text format to FILE.
+sub write_lattice
+{
+    my ($n, $file) = @_;
+    open my $out, '>', $file or die "$file: $!";
+    ## A single start state, then N layers.
+    for my $s (0 .. $WIDTH - 1) {
+        printf $out "0\t%d\t1\t1\t%.4f\n", 1 + $s, -log(rand() || 1);
+    }
+    for my $l (0 .. $n - 2) {
+        for my $s (0 .. $WIDTH - 1) {
+            my $from = 1 + $l * $WIDTH + $s;
+            for (1 .. $FANOUT) {
+                my $to = 1 + ($l + 1) * $WIDTH + int rand $WIDTH;
+                my $label = 1 + int rand 20;
+                printf $out "%d\t%d\t%d\t%d\t%.4f\n", $from, $to,
+                    $label, $label, -log(rand() || 1);
+            }
+        }
+    }
+    print $out 1 + ($n - 1) * $WIDTH + $_, "\n" for 0 .. $WIDTH - 1;
+    close $out;
+}
+
+## Seconds per call of CODE, over $REPS calls.
+sub timeit
+{
+    my $code = shift;
+    my $t = time;
+    $code->() for 1 .. $REPS;
+    (time - $t) / $REPS;
+}
+
+srand 1;
+for my $n (@ARGV) {
+    my $file = "/tmp/lattice-$$.txt";
+    write_lattice($n, $file);
+    my $log = Algorithm::OpenFST::ReadText($file, SMRLog, 0, '', '', '');
+    unlink $file;
+    my $real = $log->change_semiring(SMRReal);
+    printf "%d layers, %d states:\n", $n, $log->NumStates;
+    for my $fst ([log => $log], [real => $real]) {
+        my ($name, $f) = @$fst;
+        ## Copies start without cached distances.
+        my $dist = timeit(sub { $f->Copy->distances('forward') });
+        my $norm = timeit(sub { $f->normalize });
+        printf "  %-4s  distances %.2fms  normalize %.2fms\n",
+            $name, 1000 * $dist, 1000 * $norm;
+    }
+}
@@ -0,0 +1,313 @@
+#ifndef _bounded_determinize_h
+#define _bounded_determinize_h
+
+// Weighted subset construction with state and arc budgets and
+// optional pruning, for FSTs whose determinization may blow up.
+// Like fst::Determinize it treats the input as an acceptor (encode
+// transducers first) and epsilon as an ordinary label.
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include "fingerprint.h"
+using namespace std;
+using namespace fst;
+
+template <class Arc>
+class BoundedDeterminizer
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Label Label;
+    typedef typename Arc::Weight Weight;
+
+    /// MAX_STATES and MAX_ARCS of 0 mean no limit.  With THRESHOLD
+    /// >= 0, output states are only created on paths costing at most
+    /// THRESHOLD more than the best path; BETA must then hold the
+    /// input's reverse shortest distances, and weights are compared
+    /// by value as costs.  In the log semiring BETA sums all paths,
+    /// so the reference cost is that of every path together rather
+    /// than of the best one.
+    BoundedDeterminizer(const fst::Fst<Arc>& ifst, float delta,
+                        size_t max_states, size_t max_arcs,
+                        float threshold, const vector<Weight> * beta)
+        : ifst_(ifst), delta_(delta), max_states_(max_states),
+          max_arcs_(max_arcs), threshold_(threshold), beta_(beta),
+          narcs_(0), buckets_(1024, -1), max_subset_(0), elements_(0),
+          lookups_(0), collisions_(0), covered_(0) { }
+
+    /// Determinize into OFST.  Returns false if a budget ran out; OFST
+    /// then holds the part built so far.
+    bool run(MutableFst<Arc> * ofst);
+
+    size_t NumStates() const
+        { return subsets_.size(); }
+    size_t NumArcs() const
+        { return narcs_; }
+
+    // Subset table statistics.
+    size_t MaxSubset() const
+        { return max_subset_; }
+    double MeanSubset() const
+        { return subsets_.empty() ? 0 : (double)elements_ / subsets_.size(); }
+    /// Fraction of lookups that compared against a different subset.
+    double CollisionRate() const
+        { return lookups_ ? (double)collisions_ / lookups_ : 0; }
+    /// Distinct input states seen in any subset.
+    size_t Coverage() const
+        { return covered_; }
+    /// Without a threshold, output states at each breadth-first depth
+    /// whose states have all been created, and the coverage once
+    /// each depth was complete.
+    const vector<size_t>& Levels() const
+        { return levels_; }
+    const vector<size_t>& LevelCoverage() const
+        { return level_cover_; }
+
+private:
+    struct Element
+    {
+        StateId state;
+        Weight weight;          // residual
+        Element(StateId s, Weight w) : state(s), weight(w) { }
+        bool operator==(const Element& e) const
+            { return state == e.state && weight == e.weight; }
+    };
+    typedef vector<Element> Subset;
+
+    struct Pending
+    {
+        Label label;
+        StateId state;
+        Weight weight;
+        Pending(Label l, StateId s, Weight w)
+            : label(l), state(s), weight(w) { }
+        bool operator<(const Pending& p) const
+            {
+                return label < p.label
+                    || (label == p.label && state < p.state);
+            }
+    };
+
+    typedef pair<float, StateId> Entry;
+
+    uint64 hash(const Subset& ) const;
+    StateId find(const Subset& , uint64 , bool * added);
+    void rehash();
+    bool expand(StateId s, MutableFst<Arc> * ofst);
+    bool pruned(float cost, const Subset& ) const;
+
+    const fst::Fst<Arc>& ifst_;
+    float delta_;
+    size_t max_states_, max_arcs_;
+    float threshold_;
+    const vector<Weight> * beta_;
+    float best_;                // cost of the best path
+
+    size_t narcs_;
+    vector<Subset> subsets_;    // indexed by output state
+    vector<uint64> hashes_;
+    vector<StateId> chain_;     // next subset in the same bucket
+    vector<StateId> buckets_;
+    vector<float> alpha_;       // best cost to each output state
+    vector<bool> expanded_;
+    priority_queue<Entry, vector<Entry>, greater<Entry> > queue_;
+
+    vector<Pending> pending_;   // scratch for expand()
+    Subset next_;
+
+    size_t max_subset_, elements_;
+    size_t lookups_, collisions_;
+    size_t covered_;
+    vector<bool> seen_;         // input states counted in covered_
+    vector<size_t> levels_, level_cover_;
+};
+
+template <class Arc>
+uint64
+BoundedDeterminizer<Arc>::hash(const Subset& s) const
+{
+    uint64 h = s.size();
+    for (size_t i = 0; i < s.size(); i++)
+        h = hash_mix(hash_mix(h, s[i].state), float_bits(s[i].weight.Value()));
+    return h;
+}
+
+template <class Arc>
+void
+BoundedDeterminizer<Arc>::rehash()
+{
+    buckets_.assign(buckets_.size() * 2, -1);
+    size_t mask = buckets_.size() - 1;
+    for (size_t i = 0; i < subsets_.size(); i++) {
+        size_t b = hashes_[i] & mask;
+        chain_[i] = buckets_[b];
+        buckets_[b] = i;
+    }
+}
+
+/// The output state for subset S (with hash H), added if it is new.
+template <class Arc>
+typename BoundedDeterminizer<Arc>::StateId
+BoundedDeterminizer<Arc>::find(const Subset& s, uint64 h, bool * added)
+{
+    size_t b = h & (buckets_.size() - 1);
+    lookups_++;
+    for (StateId i = buckets_[b]; i >= 0; i = chain_[i]) {
+        if (hashes_[i] == h && subsets_[i] == s) {
+            *added = false;
+            return i;
+        }
+        collisions_++;
+    }
+    StateId ret = subsets_.size();
+    if (s.size() > max_subset_)
+        max_subset_ = s.size();
+    elements_ += s.size();
+    for (size_t j = 0; j < s.size(); j++) {
+        StateId q = s[j].state;
+        if ((size_t)q >= seen_.size())
+            seen_.resize(2 * q + 1, false);
+        if (!seen_[q]) {
+            seen_[q] = true;
+            covered_++;
+        }
+    }
+    subsets_.push_back(s);
+    hashes_.push_back(h);
+    chain_.push_back(buckets_[b]);
+    buckets_[b] = ret;
+    alpha_.push_back(0);
+    expanded_.push_back(false);
+    if (subsets_.size() > buckets_.size())
+        rehash();
+    *added = true;
+    return ret;
+}
+
+/// Whether every path through a state reached at COST with residuals
+/// S is worse than the threshold allows.
+template <class Arc>
+bool
+BoundedDeterminizer<Arc>::pruned(float cost, const Subset& s) const
+{
+    if (threshold_ < 0)
+        return false;
+    float rest = Weight::Zero().Value();
+    for (size_t i = 0; i < s.size(); i++) {
+        float c = s[i].weight.Value() + (*beta_)[s[i].state].Value();
+        if (c < rest)
+            rest = c;
+    }
+    return cost + rest > best_ + threshold_;
+}
+
+template <class Arc>
+bool
+BoundedDeterminizer<Arc>::expand(StateId s, MutableFst<Arc> * ofst)
+{
+    expanded_[s] = true;
+    Weight final = Weight::Zero();
+    pending_.clear();
+    // Copy: subsets_ may grow (and move) while we add successors.
+    const Subset cur = subsets_[s];
+    for (size_t i = 0; i < cur.size(); i++) {
+        const Element& e = cur[i];
+        final = Plus(final, Times(e.weight, ifst_.Final(e.state)));
+        for (ArcIterator<fst::Fst<Arc> > ai(ifst_, e.state);
+             !ai.Done(); ai.Next()) {
+            const Arc& a = ai.Value();
+            pending_.push_back(Pending(a.ilabel, a.nextstate,
+                                       Times(e.weight, a.weight)));
+        }
+    }
+    if (final != Weight::Zero())
+        ofst->SetFinal(s, final);
+    sort(pending_.begin(), pending_.end());
+
+    for (size_t i = 0; i < pending_.size(); ) {
+        Label label = pending_[i].label;
+        Weight w = Weight::Zero();
+        next_.clear();
+        for (; i < pending_.size() && pending_[i].label == label; i++) {
+            const Pending& p = pending_[i];
+            w = Plus(w, p.weight);
+            if (!next_.empty() && next_.back().state == p.state)
+                next_.back().weight = Plus(next_.back().weight, p.weight);
+            else
+                next_.push_back(Element(p.state, p.weight));
+        }
+        for (size_t j = 0; j < next_.size(); j++)
+            next_[j].weight
+                = Divide(next_[j].weight, w, DIVIDE_LEFT).Quantize(delta_);
+        float cost = alpha_[s] + w.Value();
+        if (pruned(cost, next_))
+            continue;
+        bool added;
+        StateId d = find(next_, hash(next_), &added);
+        if (added) {
+            if (max_states_ && subsets_.size() > max_states_)
+                return false;
+            ofst->AddState();
+            alpha_[d] = cost;
+            if (threshold_ >= 0)
+                queue_.push(Entry(cost, d));
+        } else if (cost < alpha_[d] && !expanded_[d]) {
+            alpha_[d] = cost;
+            queue_.push(Entry(cost, d));
+        }
+        ofst->AddArc(s, Arc(label, label, w, d));
+        if (++narcs_ > max_arcs_ && max_arcs_)
+            return false;
+    }
+    return true;
+}
+
+template <class Arc>
+bool
+BoundedDeterminizer<Arc>::run(MutableFst<Arc> * ofst)
+{
+    ofst->DeleteStates();
+    StateId start = ifst_.Start();
+    if (start == kNoStateId)
+        return true;
+    best_ = threshold_ >= 0 ? (*beta_)[start].Value() : 0;
+
+    Subset init;
+    init.push_back(Element(start, Weight::One()));
+    bool added;
+    find(init, hash(init), &added);
+    ofst->SetStart(ofst->AddState());
+
+    if (threshold_ < 0) {
+        // Breadth-first: states are expanded in the order they appear,
+        // so each depth is a contiguous run, complete once the depth
+        // before it has been expanded.
+        levels_.assign(1, 1);
+        level_cover_.assign(1, covered_);
+        size_t level_end = 1;
+        for (size_t s = 0; s < subsets_.size(); s++) {
+            if (s == level_end) {
+                levels_.push_back(subsets_.size() - level_end);
+                level_cover_.push_back(covered_);
+                level_end = subsets_.size();
+            }
+            if (!expand(s, ofst))
+                return false;
+        }
+    } else {
+        // Cheapest first, so each state's cost is final when expanded.
+        queue_.push(Entry(0, 0));
+        while (!queue_.empty()) {
+            Entry e = queue_.top();
+            queue_.pop();
+            if (expanded_[e.second] || e.first > alpha_[e.second])
+                continue;
+            if (!expand(e.second, ofst))
+                return false;
+        }
+    }
+    return true;
+}
+
+#endif // _bounded_determinize_h
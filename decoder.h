@@ -0,0 +1,474 @@
+#ifndef _decoder_h
+#define _decoder_h
+
+// Token-passing Viterbi search of a transducer against an input label
+// sequence, without building the input acceptor or the composition.
+// DecodeGraph is a read-only flattened copy of the FST with each
+// state's arcs sorted by input label, so the arcs matching a label
+// are found by binary search, and one graph can serve many decoders.
+// TokenDecoder keeps up to K tokens per state and input position,
+// each the cheapest way there with a distinct output so far, which is
+// enough for the K cheapest distinct outputs.  Weights are compared
+// by value as tropical costs.  Given a beam, tokens costing more than
+// the beam past the best token of their frame are dropped, and at
+// most MAX_ACTIVE states are kept per frame, both before and after
+// following its epsilon arcs, so the work per input symbol is
+// bounded by the beam rather than by the graph.  Tokens are
+// reference-counted by their successors and recycled once nothing
+// refers to them, so memory is bounded the same way.  decode_batch()
+// runs many inputs over one graph on several threads, each with its
+// own decoder.
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "fingerprint.h"
+#include "threads.h"
+using namespace std;
+using namespace fst;
+
+template <class Arc>
+struct DecodeGraph
+{
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Label Label;
+
+    struct arc
+    {
+        Label ilabel, olabel;
+        float cost;
+        StateId next;
+        bool operator<(const arc& a) const
+            { return ilabel < a.ilabel; }
+    };
+
+    StateId start;
+    vector<size_t> off;             // arcs of s are [off[s], off[s+1])
+    vector<arc> arcs;
+    vector<float> final;
+
+    explicit DecodeGraph(const ExpandedFst<Arc>& fst);
+
+    /// State S's arcs with input LABEL are [*lo, *hi).
+    void match(StateId s, Label label, size_t * lo, size_t * hi) const
+        {
+            arc key;
+            key.ilabel = label;
+            typename vector<arc>::const_iterator b = arcs.begin();
+            pair<typename vector<arc>::const_iterator,
+                typename vector<arc>::const_iterator> r
+                = equal_range(b + off[s], b + off[s + 1], key);
+            *lo = r.first - b;
+            *hi = r.second - b;
+        }
+};
+
+template <class Arc>
+DecodeGraph<Arc>::DecodeGraph(const ExpandedFst<Arc>& fst)
+    : start(fst.Start())
+{
+    StateId n = fst.NumStates();
+    off.resize(n + 1);
+    final.resize(n);
+    off[0] = 0;
+    for (StateId s = 0; s < n; s++) {
+        final[s] = fst.Final(s).Value();
+        for (ArcIterator<ExpandedFst<Arc> > ai(fst, s); !ai.Done(); ai.Next()) {
+            const Arc& a = ai.Value();
+            arc x;
+            x.ilabel = a.ilabel;
+            x.olabel = a.olabel;
+            x.cost = a.weight.Value();
+            x.next = a.nextstate;
+            arcs.push_back(x);
+        }
+        off[s + 1] = arcs.size();
+        stable_sort(arcs.begin() + off[s], arcs.end());
+    }
+}
+
+template <class Arc>
+class TokenDecoder
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Weight Weight;
+    typedef pair<vector<int>, float> result;
+
+    explicit TokenDecoder(const DecodeGraph<Arc>& g)
+        : g_(g), where_(g.final.size()), stamp_(g.final.size(), 0),
+          frame_(0) { }
+
+    /// The up to K cheapest distinct outputs for INPUT, cheapest first.
+    /// BEAM >= 0 and MAX_ACTIVE > 0 prune the search, which may then
+    /// miss the true best outputs.
+    void decode(const vector<int>& input, unsigned k, vector<result>& out,
+                float beam = -1, size_t max_active = 0);
+
+    // Search statistics for the last decode().
+    size_t Created() const
+        { return created_; }
+    size_t Pruned() const
+        { return pruned_; }
+    /// Tokens whose arcs were followed.
+    size_t Expanded() const
+        { return expanded_; }
+    /// Token slots allocated, counting each recycled slot once.
+    size_t PoolSize() const
+        { return pool_.size(); }
+
+private:
+    struct token
+    {
+        int prev;
+        int olabel;
+        float cost;
+        uint64 ohash;               // of the output so far
+        int refs;                   // entries and successors using it
+    };
+    // A state's tokens in the frame being built, cheapest first.
+    struct entry
+    {
+        StateId state;
+        bool queued;
+        vector<int> toks;
+    };
+
+    int new_token(int prev, int olabel, float cost, uint64 h);
+    void release(int t);
+    bool add(StateId s, int prev, int olabel, float cost);
+    void closure();
+    void prune();
+
+    const DecodeGraph<Arc>& g_;
+    unsigned k_;
+    float beam_;
+    size_t max_active_;
+    float best_;                    // cheapest token in the next frame
+    vector<token> pool_;
+    vector<int> free_;              // recycled slots in pool_
+    // Entries are reused between frames to keep their vectors.
+    vector<entry> cur_, next_;
+    size_t ncur_, nnext_;
+    vector<size_t> where_;          // state's entry in next_ ...
+    vector<size_t> stamp_;          // ... if its stamp is frame_
+    size_t frame_;
+    deque<size_t> queue_;
+    vector<int> scratch_;
+    vector<float> costs_;
+    size_t created_, pruned_, expanded_;
+
+    TokenDecoder(const TokenDecoder& ); // disallow
+    void operator=(const TokenDecoder& );
+};
+
+template <class Arc>
+int
+TokenDecoder<Arc>::new_token(int prev, int olabel, float cost, uint64 h)
+{
+    token t = { prev, olabel, cost, h, 1 };
+    if (prev >= 0)
+        pool_[prev].refs++;
+    created_++;
+    if (free_.empty()) {
+        pool_.push_back(t);
+        return pool_.size() - 1;
+    }
+    int i = free_.back();
+    free_.pop_back();
+    pool_[i] = t;
+    return i;
+}
+
+/// Drop a reference to T, recycling it and any predecessors left
+/// unused.
+template <class Arc>
+void
+TokenDecoder<Arc>::release(int t)
+{
+    while (t >= 0 && --pool_[t].refs == 0) {
+        free_.push_back(t);
+        t = pool_[t].prev;
+    }
+}
+
+/// Offer state S in the next frame a token extending PREV.  True if
+/// it was kept.
+template <class Arc>
+bool
+TokenDecoder<Arc>::add(StateId s, int prev, int olabel, float cost)
+{
+    if (beam_ >= 0) {
+        if (cost > best_ + beam_) {
+            pruned_++;
+            return false;
+        }
+        if (cost < best_)
+            best_ = cost;
+    }
+    if (stamp_[s] != frame_) {
+        stamp_[s] = frame_;
+        where_[s] = nnext_;
+        if (nnext_ == next_.size())
+            next_.push_back(entry());
+        next_[nnext_].state = s;
+        next_[nnext_].queued = false;
+        next_[nnext_].toks.clear();
+        nnext_++;
+    }
+    vector<int>& toks = next_[where_[s]].toks;
+    uint64 h = prev < 0 ? 0 : pool_[prev].ohash;
+    if (olabel)
+        h = hash_mix(h, olabel);
+    for (size_t i = 0; i < toks.size(); i++) {
+        if (pool_[toks[i]].ohash != h)
+            continue;
+        // Same output: keep only the cheaper.
+        if (cost >= pool_[toks[i]].cost)
+            return false;
+        release(toks[i]);
+        toks.erase(toks.begin() + i);
+        break;
+    }
+    if (toks.size() >= k_ && cost >= pool_[toks.back()].cost)
+        return false;
+    int t = new_token(prev, olabel, cost, h);
+    size_t i = toks.size();
+    toks.push_back(t);
+    for (; i > 0 && pool_[toks[i - 1]].cost > cost; i--)
+        toks[i] = toks[i - 1];
+    toks[i] = t;
+    if (toks.size() > k_) {
+        release(toks.back());
+        toks.pop_back();
+    }
+    return true;
+}
+
+/// Follow epsilon-input arcs within the next frame.
+template <class Arc>
+void
+TokenDecoder<Arc>::closure()
+{
+    for (size_t e = 0; e < nnext_; e++) {
+        next_[e].queued = true;
+        queue_.push_back(e);
+    }
+    while (!queue_.empty()) {
+        size_t e = queue_.front();
+        queue_.pop_front();
+        next_[e].queued = false;
+        StateId s = next_[e].state;
+        size_t lo, hi;
+        g_.match(s, 0, &lo, &hi);
+        if (lo == hi)
+            continue;
+        // Copy, and hold on to the copies: adding may replace this
+        // entry's tokens.
+        scratch_ = next_[e].toks;
+        for (size_t i = 0; i < scratch_.size(); i++)
+            pool_[scratch_[i]].refs++;
+        expanded_ += scratch_.size();
+        for (size_t i = 0; i < scratch_.size(); i++) {
+            int t = scratch_[i];
+            for (size_t j = lo; j < hi; j++) {
+                const typename DecodeGraph<Arc>::arc& a = g_.arcs[j];
+                if (add(a.next, t, a.olabel, pool_[t].cost + a.cost)) {
+                    entry& d = next_[where_[a.next]];
+                    if (!d.queued) {
+                        d.queued = true;
+                        queue_.push_back(where_[a.next]);
+                    }
+                }
+            }
+        }
+        for (size_t i = 0; i < scratch_.size(); i++)
+            release(scratch_[i]);
+    }
+}
+
+/// Drop the next frame's tokens outside the beam, and all but its
+/// MAX_ACTIVE cheapest states.
+template <class Arc>
+void
+TokenDecoder<Arc>::prune()
+{
+    if ((beam_ < 0 && !max_active_) || !nnext_)
+        return;
+    float cut = Weight::Zero().Value();
+    if (beam_ >= 0) {
+        float best = cut;
+        for (size_t e = 0; e < nnext_; e++)
+            best = min(best, pool_[next_[e].toks[0]].cost);
+        cut = best + beam_;
+    }
+    // States costing exactly the histogram cutoff are kept only while
+    // there is room.
+    size_t room = nnext_;
+    if (max_active_ && nnext_ > max_active_) {
+        costs_.resize(nnext_);
+        for (size_t e = 0; e < nnext_; e++)
+            costs_[e] = pool_[next_[e].toks[0]].cost;
+        nth_element(costs_.begin(), costs_.begin() + max_active_ - 1,
+                    costs_.end());
+        if (costs_[max_active_ - 1] <= cut) {
+            cut = costs_[max_active_ - 1];
+            room = max_active_;
+            for (size_t e = 0; e < nnext_; e++)
+                if (costs_[e] < cut)
+                    room--;
+        }
+    }
+    size_t kept = 0;
+    for (size_t e = 0; e < nnext_; e++) {
+        vector<int>& toks = next_[e].toks;
+        float c = pool_[toks[0]].cost;
+        bool keep = c < cut || (c == cut && room > 0);
+        if (keep && c == cut)
+            room--;
+        while (!toks.empty()
+               && (!keep || pool_[toks.back()].cost > cut)) {
+            release(toks.back());
+            toks.pop_back();
+            pruned_++;
+        }
+        // Keep where_ and stamp_ right for a closure() still to come.
+        StateId s = next_[e].state;
+        if (!keep) {
+            stamp_[s] = 0;
+            continue;
+        }
+        if (kept != e) {
+            next_[kept].state = s;
+            next_[kept].toks.swap(toks);
+            where_[s] = kept;
+        }
+        kept++;
+    }
+    nnext_ = kept;
+}
+
+template <class Arc>
+void
+TokenDecoder<Arc>::decode(const vector<int>& input, unsigned k,
+                          vector<result>& out, float beam,
+                          size_t max_active)
+{
+    out.clear();
+    created_ = pruned_ = expanded_ = 0;
+    pool_.clear();
+    free_.clear();
+    if (g_.start == kNoStateId || k == 0)
+        return;
+    k_ = k;
+    beam_ = beam;
+    max_active_ = max_active;
+    float inf = Weight::Zero().Value();
+    nnext_ = 0;
+    frame_++;
+    best_ = inf;
+    add(g_.start, -1, 0, 0);
+    closure();
+    prune();
+
+    for (size_t p = 0; p < input.size() && nnext_; p++) {
+        if (!input[p])
+            continue;
+        cur_.swap(next_);
+        ncur_ = nnext_;
+        nnext_ = 0;
+        frame_++;
+        best_ = inf;
+        for (size_t e = 0; e < ncur_; e++) {
+            size_t lo, hi;
+            g_.match(cur_[e].state, input[p], &lo, &hi);
+            if (lo < hi)
+                expanded_ += cur_[e].toks.size();
+            for (size_t i = 0; i < cur_[e].toks.size(); i++) {
+                int t = cur_[e].toks[i];
+                for (size_t j = lo; j < hi; j++) {
+                    const typename DecodeGraph<Arc>::arc& a = g_.arcs[j];
+                    add(a.next, t, a.olabel, pool_[t].cost + a.cost);
+                }
+            }
+        }
+        for (size_t e = 0; e < ncur_; e++)
+            for (size_t i = 0; i < cur_[e].toks.size(); i++)
+                release(cur_[e].toks[i]);
+        // Prune before following epsilons too, so that MAX_ACTIVE
+        // also bounds the states the closure starts from.
+        prune();
+        closure();
+        prune();
+    }
+
+    // Finish in final states, keeping the cheapest of each output.
+    vector<pair<float, int> > ends;
+    for (size_t e = 0; e < nnext_; e++) {
+        float f = g_.final[next_[e].state];
+        if (f < inf)
+            for (size_t i = 0; i < next_[e].toks.size(); i++)
+                ends.push_back(make_pair(pool_[next_[e].toks[i]].cost + f,
+                                         next_[e].toks[i]));
+    }
+    sort(ends.begin(), ends.end());
+    vector<uint64> seen;
+    for (size_t i = 0; i < ends.size() && out.size() < k; i++) {
+        int t = ends[i].second;
+        if (find(seen.begin(), seen.end(), pool_[t].ohash) != seen.end())
+            continue;
+        seen.push_back(pool_[t].ohash);
+        out.push_back(result(vector<int>(), ends[i].first));
+        vector<int>& labels = out.back().first;
+        for (; t >= 0; t = pool_[t].prev)
+            if (pool_[t].olabel)
+                labels.push_back(pool_[t].olabel);
+        reverse(labels.begin(), labels.end());
+    }
+}
+
+template <class Arc>
+struct decode_job
+{
+    typedef typename TokenDecoder<Arc>::result result;
+    const vector<vector<int> > * in;
+    const vector<TokenDecoder<Arc> *> * dec;
+    unsigned k;
+    vector<vector<result> > * out;
+    void operator()(int i, int worker)
+        { (*dec)[worker]->decode((*in)[i], k, (*out)[i]); }
+};
+
+/// Decode each of INPUTS against G on up to THREADS threads, as
+/// TokenDecoder::decode would.  FIRST, if not NULL, is a decoder for G
+/// to use on the calling thread; the other threads get their own.
+template <class Arc>
+void
+decode_batch(const DecodeGraph<Arc>& g, TokenDecoder<Arc> * first,
+             const vector<vector<int> >& inputs, unsigned k, int threads,
+             vector<vector<typename TokenDecoder<Arc>::result> >& out)
+{
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > inputs.size())
+        threads = inputs.size() ? inputs.size() : 1;
+    out.clear();
+    out.resize(inputs.size());
+    vector<TokenDecoder<Arc> *> dec(threads);
+    for (int i = 0; i < threads; i++)
+        dec[i] = i == 0 && first ? first : new TokenDecoder<Arc>(g);
+    decode_job<Arc> j = { &inputs, &dec, k, &out };
+    try {
+        parallel_for(inputs.size(), threads, j, 16);
+    } catch (...) {
+        for (int i = 0; i < threads; i++)
+            if (dec[i] != first)
+                delete dec[i];
+        throw;
+    }
+    for (int i = 0; i < threads; i++)
+        if (dec[i] != first)
+            delete dec[i];
+}
+
+#endif // _decoder_h
@@ -0,0 +1,235 @@
+#ifndef _eps_removal_h
+#define _eps_removal_h
+
+// Multi-threaded epsilon removal.  Each state's new arcs are its
+// epsilon closure's non-epsilon arcs, weighted by the closure's
+// shortest distances, so states can be done independently and are
+// simply handed out to worker threads.  Arcs reached through several
+// closure states are merged, as the library's RmEpsilon does.  Each
+// worker keeps distances only for the closure it is working on, found
+// through a hash table, so its scratch grows with the largest closure
+// rather than with the FST.  The input is read from a flattened copy,
+// so workers never touch the FST itself, and the new arcs are written
+// back a batch of states at a time.
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "threads.h"
+using namespace std;
+using namespace fst;
+
+template <class Arc>
+class EpsilonRemover
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Weight Weight;
+
+    EpsilonRemover(const MutableFst<Arc>& fst, float delta);
+
+    /// Remove epsilons on up to THREADS threads, replacing FST's arcs
+    /// and final weights.
+    void run(MutableFst<Arc> * fst, int threads);
+
+private:
+    struct eps_arc
+    {
+        StateId dst;
+        Weight weight;
+        eps_arc(StateId d, Weight w) : dst(d), weight(w) { }
+    };
+
+    // Per-thread shortest-distance state for one closure, indexed by
+    // the order in which its states were reached.
+    struct scratch
+    {
+        hash_map<StateId, size_t> index;
+        vector<StateId> states;
+        vector<Weight> d, r;
+        vector<bool> queued;
+        deque<size_t> queue;
+    };
+
+    // Closes the states of one batch, from BASE.
+    struct job
+    {
+        EpsilonRemover * e;
+        StateId base;
+        void operator()(int i, int worker)
+            { e->close(base + i, i, e->work[worker]); }
+    };
+
+    // Orders arcs so that duplicates are adjacent.
+    struct arc_less
+    {
+        bool operator()(const Arc& a, const Arc& b) const
+            {
+                if (a.ilabel != b.ilabel)
+                    return a.ilabel < b.ilabel;
+                if (a.olabel != b.olabel)
+                    return a.olabel < b.olabel;
+                return a.nextstate < b.nextstate;
+            }
+    };
+
+    float delta;
+    StateId n;
+    // Flattened input: epsilon arcs and everything else, by state.
+    vector<size_t> eoff, aoff;
+    vector<eps_arc> eps;
+    vector<Arc> arcs;
+    vector<Weight> final;
+
+    vector<scratch> work;
+    // New arcs and final weights for the current batch.
+    vector<vector<Arc> > out;
+    vector<Weight> out_final;
+
+    size_t reach(StateId s, scratch& w);
+    void close(StateId s, size_t i, scratch& w);
+};
+
+template <class Arc>
+EpsilonRemover<Arc>::EpsilonRemover(const MutableFst<Arc>& fst, float del)
+    : delta(del), n(fst.NumStates())
+{
+    eoff.resize(n + 1);
+    aoff.resize(n + 1);
+    final.reserve(n);
+    eoff[0] = aoff[0] = 0;
+    for (StateId s = 0; s < n; s++) {
+        final.push_back(fst.Final(s));
+        for (ArcIterator<MutableFst<Arc> > ai(fst, s); !ai.Done(); ai.Next()) {
+            const Arc& a = ai.Value();
+            if (a.ilabel == 0 && a.olabel == 0)
+                eps.push_back(eps_arc(a.nextstate, a.weight));
+            else
+                arcs.push_back(a);
+        }
+        eoff[s + 1] = eps.size();
+        aoff[s + 1] = arcs.size();
+    }
+}
+
+/// State S's entry in W, added with zero distance if new.
+template <class Arc>
+size_t
+EpsilonRemover<Arc>::reach(StateId s, scratch& w)
+{
+    typename hash_map<StateId, size_t>::iterator it = w.index.find(s);
+    if (it != w.index.end())
+        return it->second;
+    size_t e = w.states.size();
+    w.index[s] = e;
+    w.states.push_back(s);
+    w.d.push_back(Weight::Zero());
+    w.r.push_back(Weight::Zero());
+    w.queued.push_back(false);
+    return e;
+}
+
+/// Compute state S's new arcs and final weight, into slot I of the
+/// batch.
+template <class Arc>
+void
+EpsilonRemover<Arc>::close(StateId s, size_t i, scratch& w)
+{
+    vector<Arc>& o = out[i];
+    if (eoff[s] == eoff[s + 1]) {
+        o.assign(arcs.begin() + aoff[s], arcs.begin() + aoff[s + 1]);
+        out_final[i] = final[s];
+        return;
+    }
+    // Generic single-source shortest distance over epsilon arcs.
+    size_t e = reach(s, w);
+    w.d[e] = w.r[e] = Weight::One();
+    w.queue.push_back(e);
+    w.queued[e] = true;
+    while (!w.queue.empty()) {
+        size_t qe = w.queue.front();
+        w.queue.pop_front();
+        w.queued[qe] = false;
+        StateId q = w.states[qe];
+        Weight r = w.r[qe];
+        w.r[qe] = Weight::Zero();
+        for (size_t j = eoff[q]; j < eoff[q + 1]; j++) {
+            size_t t = reach(eps[j].dst, w);
+            Weight x = Times(r, eps[j].weight);
+            Weight nd = Plus(w.d[t], x);
+            if (!ApproxEqual(w.d[t], nd, delta)) {
+                w.d[t] = nd;
+                w.r[t] = Plus(w.r[t], x);
+                if (!w.queued[t]) {
+                    w.queued[t] = true;
+                    w.queue.push_back(t);
+                }
+            }
+        }
+    }
+    // Collect the closure's arcs, and leave the scratch empty.
+    Weight f = Weight::Zero();
+    for (size_t k = 0; k < w.states.size(); k++) {
+        StateId q = w.states[k];
+        Weight d = w.d[k];
+        if (final[q] != Weight::Zero())
+            f = Plus(f, Times(d, final[q]));
+        for (size_t j = aoff[q]; j < aoff[q + 1]; j++) {
+            Arc a = arcs[j];
+            a.weight = Times(d, a.weight);
+            o.push_back(a);
+        }
+        w.index.erase(q);
+    }
+    w.states.clear();
+    w.d.clear();
+    w.r.clear();
+    w.queued.clear();
+    out_final[i] = f;
+
+    // Merge arcs with the same labels and target.
+    sort(o.begin(), o.end(), arc_less());
+    size_t k = 0;
+    for (size_t j = 0; j < o.size(); j++) {
+        if (k > 0 && o[k - 1].ilabel == o[j].ilabel
+            && o[k - 1].olabel == o[j].olabel
+            && o[k - 1].nextstate == o[j].nextstate)
+            o[k - 1].weight = Plus(o[k - 1].weight, o[j].weight);
+        else
+            o[k++] = o[j];
+    }
+    o.resize(k);
+}
+
+template <class Arc>
+void
+EpsilonRemover<Arc>::run(MutableFst<Arc> * fst, int threads)
+{
+    if (threads < 1)
+        threads = 1;
+    work.resize(threads);
+    // Enough states per batch to keep every thread busy.
+    StateId batch = 1024 * threads;
+    for (StateId base = 0; base < n; base += batch) {
+        StateId m = min(batch, n - base);
+        out.resize(m);
+        out_final.resize(m);
+        job j = { this, base };
+        parallel_for(m, threads, j, 64);
+        // Workers only read the flattened copy, so the FST can be
+        // rewritten between batches.
+        for (StateId i = 0; i < m; i++) {
+            fst->DeleteArcs(base + i);
+            fst->SetFinal(base + i, out_final[i]);
+            for (size_t k = 0; k < out[i].size(); k++)
+                fst->AddArc(base + i, out[i][k]);
+            out[i].clear();
+        }
+    }
+    vector<scratch>().swap(work);
+    vector<vector<Arc> >().swap(out);
+    vector<Weight>().swap(out_final);
+    Connect(fst);
+}
+
+#endif // _eps_removal_h
@@ -0,0 +1,25 @@
+#ifndef _fingerprint_h
+#define _fingerprint_h
+
+// Hashing helpers shared by the FST fingerprints and the algorithms
+// that hash states or subsets.
+
+#include <string.h>
+
+static inline uint64
+hash_mix(uint64 h, uint64 v)
+{
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    return (h ^ v) * 0xc4ceb9fe1a85ec53ULL + 0x9e3779b97f4a7c15ULL;
+}
+
+static inline uint32
+float_bits(float f)
+{
+    uint32 ret;
+    memcpy(&ret, &f, sizeof ret);
+    return ret;
+}
+
+#endif // _fingerprint_h
@@ -0,0 +1,320 @@
+#ifndef _lazy_fst_h
+#define _lazy_fst_h
+
+// Lazy results behind the MutableFst interface FSTImpl expects.
+// LazyMutableFst answers reads from a read-only view and turns itself
+// into a VectorFst on the first write.  ReverseView is such a view of
+// fst::Reverse's result, with the same state numbering: state 0 is a
+// new start state with epsilon arcs to the old final states, and old
+// state s becomes s + 1.  SemiringView reads one semiring's VectorFst
+// as another's, in place.
+
+#include <vector>
+using namespace std;
+using namespace fst;
+
+template <class A>
+class LazyMutableFst : public MutableFst<A>
+{
+public:
+    typedef A Arc;
+    typedef typename A::Weight Weight;
+    typedef typename A::StateId StateId;
+
+    /// Takes ownership of VIEW.
+    explicit LazyMutableFst(ExpandedFst<A> * view)
+        : view_(view), impl_(NULL) { }
+    ~LazyMutableFst()
+        {
+            delete view_;
+            delete impl_;
+        }
+
+    // Reads
+    virtual StateId Start() const
+        { return get().Start(); }
+    virtual Weight Final(StateId s) const
+        { return get().Final(s); }
+    virtual size_t NumArcs(StateId s) const
+        { return get().NumArcs(s); }
+    virtual size_t NumInputEpsilons(StateId s) const
+        { return get().NumInputEpsilons(s); }
+    virtual size_t NumOutputEpsilons(StateId s) const
+        { return get().NumOutputEpsilons(s); }
+    virtual StateId NumStates() const
+        { return get().NumStates(); }
+    virtual uint64 Properties(uint64 mask, bool test) const
+        { return get().Properties(mask, test); }
+    virtual const string& Type() const
+        { return get().Type(); }
+    virtual const SymbolTable * InputSymbols() const
+        { return get().InputSymbols(); }
+    virtual const SymbolTable * OutputSymbols() const
+        { return get().OutputSymbols(); }
+    virtual void InitStateIterator(StateIteratorData<A> * data) const
+        { get().InitStateIterator(data); }
+    virtual void InitArcIterator(StateId s, ArcIteratorData<A> * data) const
+        { get().InitArcIterator(s, data); }
+    virtual bool Write(ostream& strm, const FstWriteOptions& opts) const
+        { return mut().Write(strm, opts); }
+    virtual LazyMutableFst<A> * Copy() const
+        {
+            if (impl_)
+                return new LazyMutableFst<A>(NULL, impl_->Copy());
+            return new LazyMutableFst<A>(
+                static_cast<ExpandedFst<A> *>(view_->Copy()), NULL);
+        }
+
+    // Writes
+    virtual LazyMutableFst<A>& operator=(const Fst<A>& f)
+        {
+            mut() = f;
+            return *this;
+        }
+    virtual void SetStart(StateId s)
+        { mut().SetStart(s); }
+    virtual void SetFinal(StateId s, Weight w)
+        { mut().SetFinal(s, w); }
+    virtual void SetProperties(uint64 props, uint64 mask)
+        { mut().SetProperties(props, mask); }
+    virtual StateId AddState()
+        { return mut().AddState(); }
+    virtual void AddArc(StateId s, const A& arc)
+        { mut().AddArc(s, arc); }
+    virtual void DeleteStates(const vector<StateId>& dstates)
+        { mut().DeleteStates(dstates); }
+    virtual void DeleteStates()
+        { mut().DeleteStates(); }
+    virtual void DeleteArcs(StateId s, size_t n)
+        { mut().DeleteArcs(s, n); }
+    virtual void DeleteArcs(StateId s)
+        { mut().DeleteArcs(s); }
+    virtual void SetInputSymbols(const SymbolTable * isyms)
+        { mut().SetInputSymbols(isyms); }
+    virtual void SetOutputSymbols(const SymbolTable * osyms)
+        { mut().SetOutputSymbols(osyms); }
+    virtual void InitMutableArcIterator(StateId s,
+                                        MutableArcIteratorData<A> * data)
+        { mut().InitMutableArcIterator(s, data); }
+
+private:
+    mutable ExpandedFst<A> * view_;
+    mutable VectorFst<A> * impl_;
+
+    LazyMutableFst(ExpandedFst<A> * view, VectorFst<A> * impl)
+        : view_(view), impl_(impl) { }
+
+    const ExpandedFst<A>& get() const
+        {
+            if (impl_)
+                return *impl_;
+            return *view_;
+        }
+    /// Materialize, dropping the view.
+    VectorFst<A>& mut() const
+        {
+            if (!impl_) {
+                impl_ = new VectorFst<A>(*view_);
+                delete view_;
+                view_ = NULL;
+            }
+            return *impl_;
+        }
+
+    void operator=(const LazyMutableFst<A>& ); // disallow
+};
+
+template <class A>
+class ReverseView : public ExpandedFst<A>
+{
+public:
+    typedef A Arc;
+    typedef typename A::Weight Weight;
+    typedef typename A::StateId StateId;
+
+    explicit ReverseView(const MutableFst<A>& f)
+        : fst_(f.Copy()), built_(false) { }
+    ReverseView(const ReverseView<A>& v)
+        : ExpandedFst<A>(), fst_(v.fst_->Copy()), built_(false) { }
+    ~ReverseView()
+        { delete fst_; }
+
+    virtual StateId Start() const
+        { return 0; }
+    virtual Weight Final(StateId s) const
+        {
+            return s > 0 && s - 1 == fst_->Start()
+                ? Weight::One() : Weight::Zero();
+        }
+    virtual StateId NumStates() const
+        { return fst_->NumStates() + 1; }
+    virtual size_t NumArcs(StateId s) const
+        {
+            build();
+            return off_[s + 1] - off_[s];
+        }
+    virtual size_t NumInputEpsilons(StateId s) const
+        { return count_eps(s, true); }
+    virtual size_t NumOutputEpsilons(StateId s) const
+        { return count_eps(s, false); }
+    /// Without TEST, what is known about the input, reversed; with
+    /// it, the properties are computed from the view itself.
+    virtual uint64 Properties(uint64 mask, bool test) const
+        {
+            if (test) {
+                uint64 known;
+                return TestProperties(*this, mask, &known) & mask;
+            }
+            return ReverseProperties(fst_->Properties(kFstProperties, false))
+                & mask;
+        }
+    virtual const string& Type() const
+        {
+            static const string type("reverse");
+            return type;
+        }
+    virtual ReverseView<A> * Copy() const
+        { return new ReverseView<A>(*this); }
+    virtual const SymbolTable * InputSymbols() const
+        { return fst_->InputSymbols(); }
+    virtual const SymbolTable * OutputSymbols() const
+        { return fst_->OutputSymbols(); }
+    virtual void InitStateIterator(StateIteratorData<A> * data) const
+        {
+            data->base = 0;
+            data->nstates = NumStates();
+        }
+    virtual void InitArcIterator(StateId s, ArcIteratorData<A> * data) const
+        {
+            build();
+            data->base = 0;
+            data->arcs = arcs_.empty() ? 0 : &arcs_[off_[s]];
+            data->narcs = off_[s + 1] - off_[s];
+            data->ref_count = 0;
+        }
+
+private:
+    MutableFst<A> * fst_;
+    // Incoming-arc index, built on first use: arcs of reversed state
+    // s are arcs_[off_[s] .. off_[s+1]).
+    mutable bool built_;
+    mutable vector<size_t> off_;
+    mutable vector<A> arcs_;
+
+    void build() const;
+    size_t count_eps(StateId s, bool input) const
+        {
+            build();
+            size_t ret = 0;
+            for (size_t i = off_[s]; i < off_[s + 1]; i++)
+                if ((input ? arcs_[i].ilabel : arcs_[i].olabel) == 0)
+                    ret++;
+            return ret;
+        }
+
+    void operator=(const ReverseView<A>& ); // disallow
+};
+
+template <class A>
+void
+ReverseView<A>::build() const
+{
+    if (built_)
+        return;
+    built_ = true;
+    StateId n = fst_->NumStates();
+    off_.assign(n + 2, 0);
+    // Count, then fill, arcs into each reversed state.
+    for (StateId s = 0; s < n; s++) {
+        if (fst_->Final(s) != Weight::Zero())
+            off_[1]++;
+        for (ArcIterator<MutableFst<A> > ai(*fst_, s); !ai.Done(); ai.Next())
+            off_[ai.Value().nextstate + 2]++;
+    }
+    for (StateId s = 0; s <= n; s++)
+        off_[s + 1] += off_[s];
+    arcs_.resize(off_[n + 1]);
+    vector<size_t> pos(off_.begin(), off_.end() - 1);
+    for (StateId s = 0; s < n; s++) {
+        Weight f = fst_->Final(s);
+        if (f != Weight::Zero())
+            arcs_[pos[0]++] = A(0, 0, f.Reverse(), s + 1);
+        for (ArcIterator<MutableFst<A> > ai(*fst_, s); !ai.Done(); ai.Next()) {
+            const A& a = ai.Value();
+            arcs_[pos[a.nextstate + 1]++]
+                = A(a.ilabel, a.olabel, a.weight.Reverse(), s + 1);
+        }
+    }
+}
+
+/// A VectorFst<A> seen as an FST of B arcs, for semirings with the
+/// same float weights such as log and tropical.  Arcs are read from
+/// A's own storage, so the two arc types must share a layout.
+template <class A, class B>
+class SemiringView : public ExpandedFst<B>
+{
+public:
+    typedef B Arc;
+    typedef typename B::Weight Weight;
+    typedef typename B::StateId StateId;
+
+    explicit SemiringView(const VectorFst<A>& f)
+        : fst_(f.Copy()) { }
+    SemiringView(const SemiringView<A, B>& v)
+        : ExpandedFst<B>(), fst_(v.fst_->Copy()) { }
+    ~SemiringView()
+        { delete fst_; }
+
+    virtual StateId Start() const
+        { return fst_->Start(); }
+    virtual Weight Final(StateId s) const
+        { return Weight(fst_->Final(s).Value()); }
+    virtual StateId NumStates() const
+        { return fst_->NumStates(); }
+    virtual size_t NumArcs(StateId s) const
+        { return fst_->NumArcs(s); }
+    virtual size_t NumInputEpsilons(StateId s) const
+        { return fst_->NumInputEpsilons(s); }
+    virtual size_t NumOutputEpsilons(StateId s) const
+        { return fst_->NumOutputEpsilons(s); }
+    virtual uint64 Properties(uint64 mask, bool test) const
+        { return fst_->Properties(mask, test); }
+    virtual const string& Type() const
+        {
+            static const string type("semiring");
+            return type;
+        }
+    virtual SemiringView<A, B> * Copy() const
+        { return new SemiringView<A, B>(*this); }
+    virtual const SymbolTable * InputSymbols() const
+        { return fst_->InputSymbols(); }
+    virtual const SymbolTable * OutputSymbols() const
+        { return fst_->OutputSymbols(); }
+    virtual void InitStateIterator(StateIteratorData<B> * data) const
+        {
+            data->base = 0;
+            data->nstates = NumStates();
+        }
+    virtual void InitArcIterator(StateId s, ArcIteratorData<B> * data) const
+        {
+            ArcIteratorData<A> d;
+            fst_->InitArcIterator(s, &d);
+            data->base = 0;
+            data->arcs = reinterpret_cast<const B *>(d.arcs);
+            data->narcs = d.narcs;
+            data->ref_count = d.ref_count;
+        }
+
+private:
+    VectorFst<A> * fst_;
+
+    // Instantiating the view fails to compile unless the arcs could
+    // share storage: a negative array size if they cannot.
+    typedef char same_layout[sizeof(A) == sizeof(B)
+                             && sizeof(typename A::Weight)
+                                == sizeof(typename B::Weight) ? 1 : -1];
+
+    void operator=(const SemiringView<A, B>& ); // disallow
+};
+
+#endif // _lazy_fst_h
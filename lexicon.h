@@ -0,0 +1,70 @@
+#ifndef _lexicon_h
+#define _lexicon_h
+
+// Daciuk et al.'s incremental construction of minimal acyclic
+// acceptors from sorted words.  Only the path of the last word added
+// is open to change; once a word diverges from it, the rest of the old
+// path is frozen, each state being either merged into an equivalent
+// one from a register or registered itself.  The trie is never built,
+// so memory stays proportional to the minimal automaton.  Words out of
+// order are caught when they would need to change a frozen state.
+
+#include <string>
+#include <vector>
+using namespace std;
+
+struct FST;
+
+class LexiconBuilder
+{
+public:
+    /// Build an FST in semiring SMR (SMRLog, SMRTropical).
+    explicit LexiconBuilder(int smr);
+    ~LexiconBuilder();
+
+    /// Add WORD, a sequence of symbols.  Returns false if it was out
+    /// of order; the builder is then unchanged.
+    bool add(const vector<string>& word);
+    /// Freeze the last word and return the automaton, leaving the
+    /// builder empty.
+    FST * finish();
+
+    /// States currently in use.
+    size_t NumStates() const
+        { return states.size() - unused.size(); }
+
+private:
+    typedef pair<int, int> arc;     // label, target
+
+    struct state
+    {
+        vector<arc> arcs;
+        bool final;
+        bool registered;
+        state() : final(false), registered(false) { }
+    };
+
+    int smr;
+    fst::SymbolTable * syms;
+    vector<state> states;           // 0 is the start state
+    vector<int> unused;             // free slots in states
+    vector<int> path;               // states along the last word
+    vector<int> labels;             // ... and its labels
+
+    // Register of frozen states, chained by hash bucket.
+    vector<int> heads, chain;
+    vector<size_t> hashes;
+    size_t nregistered;
+
+    int new_state();
+    size_t hash(int s) const;
+    bool same(int a, int b) const;
+    int find_or_register(int s);
+    void freeze(size_t depth);
+    void reset();
+
+    LexiconBuilder(const LexiconBuilder& ); // disallow
+    void operator=(const LexiconBuilder& );
+};
+
+#endif // _lexicon_h
@@ -16,7 +16,13 @@ The interface is very incomplete, since I have only implemented the
 parts I need right now.  At the lowest level, the function and method
 names are the same as the C++ interface, except that destructive
 methods have a leading underscore.  Non-destructive equivalents are
-provided without the leading underscore.
+provided without the leading underscore.  These copy their input
+unless it is a temporary nobody else refers to, such as the result of
+the previous call in C<$f-E<gt>RmEpsilon-E<gt>Determinize-E<gt>Minimize>,
+in which case they reuse it.  C<Algorithm::OpenFST::copy_count>
+returns the number of times an FST object has been copied by
+non-destructive methods, C<Copy>, the result cache and iterators.
+Copies made while an algorithm runs are not counted.
 
 C<Algorithm::OpenFST> provides a convenient higher-level interface to
 OpenFST's basic operations.  Methods in this interface have
@@ -34,7 +40,7 @@ use vars qw(@ISA @EXPORT_OK @EXPORT_TAGS);
 BEGIN {
 require XSLoader;
 XSLoader::load('Algorithm::OpenFST', $VERSION);
-my @CONST = qw(INPUT OUTPUT INITIAL FINAL STAR PLUS SMRLog SMRTropical
+my @CONST = qw(INPUT OUTPUT INITIAL FINAL STAR PLUS SMRLog SMRTropical SMRReal
                ENCODE_LABEL ENCODE_WEIGHT ACCEPTOR NOT_ACCEPTOR);
 eval "sub $_ () { ".Algorithm::OpenFST::constant($_)."}" for @CONST;
 
@@ -42,8 +48,11 @@ eval "sub $_ () { ".Algorithm::OpenFST::constant($_)."}" for @CONST;
 @EXPORT_OK = (qw(
 acceptor
 compose
+compose_batch
 concat
+decode_batch
 from_list
+lexicon_builder
 transducer
 union
 universal
@@ -58,7 +67,17 @@ universal
 
 =head3 C<$fst = VectorFST $smr>
 
-Create a mutable FST with semiring $smr.
+Create a mutable FST with semiring $smr: C<SMRLog> or C<SMRTropical>,
+whose weights are costs, or C<SMRReal>, whose weights are
+probabilities added and multiplied directly.  The real semiring is
+much faster than the log semiring for C<distances()> and
+C<normalize()> on acyclic FSTs (see F<bench/semiring.pl>), but has no
+shortest paths: C<best_paths()> and C<prune()> go through the
+tropical semiring, and C<change_semiring()> converts weights between
+probabilities and costs.  Searches that treat weights as costs, such
+as C<paths()>, C<transduce()>, C<ShortestPath()> and C<Prune()>, die
+on a real FST, as do C<distances()> and C<normalize()> on a cyclic
+one, whose sums over cycles need not converge.
 
 =head3 C<$fsa = acceptor $file, %opts>
 
@@ -194,38 +213,116 @@ sub compose
     $ret
 }
 
-sub concat
+=head3 C<@fsts = compose_batch $big, \@small, %opts>
+
+Compose each transducer in @small with $big, returning the results in
+the same order.  $big is sorted and indexed once, and the compositions
+run in C++ without returning to Perl in between.  Options include:
+
+=over 4
+
+=item B<threads> -- Number of threads to compose on (default 1).
+
+=item B<nbest> -- If nonzero, return only the best I<nbest> paths of
+each composition.  Non-tropical FSTs are searched in the tropical
+semiring, as in C<best_paths()>.
+
+=back
+
+=cut
+
+sub compose_batch
 {
-    my $ret = shift->Copy;
-    $ret->_Concat($_) for @_;
-    $ret;
+    my ($big, $small, %o) = @_;
+    Algorithm::OpenFST::_compose_batch($big, $small, $o{threads} || 1,
+                                       $o{nbest} || 0);
 }
 
-sub union
+=head3 C<@results = decode_batch $fst, \@sequences, %opts>
+
+Transduce each array of input symbols in @sequences against $fst, as
+C<$fst-E<gt>transduce> would, returning one array of
+C<[\@output_symbols, $cost]> per sequence, in the same order.  The
+sequences are decoded in C++ without returning to Perl in between,
+each thread with its own search space over a single shared copy of
+$fst.  Options include:
+
+=over 4
+
+=item B<threads> -- Number of threads to decode on (default 1).
+
+=item B<nbest> -- Number of distinct outputs to return for each
+sequence (default 1).
+
+=back
+
+=cut
+
+sub decode_batch
 {
-    my $ret = shift->Copy;
-    $ret->_Union($_) for @_;
-    $ret;
+    my ($fst, $seqs, %o) = @_;
+    Algorithm::OpenFST::_decode_batch($fst, $seqs, $o{threads} || 1,
+                                      $o{nbest} || 1);
 }
 
-## Supplementary methods
-package Algorithm::OpenFST::FST;
+=head2 Result Cache
 
-use overload '""' => sub { shift->String };
+=head3 C<Algorithm::OpenFST::cache_size $n>
 
-## Non-destructive versions of destructive ops.
-BEGIN {
-for (qw(Union Concat Closure Project RmEpsilon Prune Push Encode Decode Invert)) {
-    eval '
-sub '.$_.' {
-    my $ret = shift->Copy;
-    $ret->_'.$_.'(@_);
-    $ret
-}';
-    die $@ if $@;
+Remember the results of the last $n calls to C<Compose>,
+C<Intersect>, C<Difference> and C<Determinize>, keyed by content
+fingerprints of their operands and by their parameters.  Repeating a
+call on unchanged operands then returns a copy of the cached result;
+the copy shares storage with the cache until either is modified.  The
+cache is off (size 0) by default, and setting the size to 0 empties
+it.
+
+=head3 C<%stats = Algorithm::OpenFST::cache_stats>
+
+Return the cache's B<hits>, B<misses>, current number of B<entries>,
+and maximum B<size>.
+
+=cut
+
+=head2 Lexicons
+
+=head3 C<$b = lexicon_builder [$smr]>
+
+Create a builder for the minimal acceptor of a word list, in semiring
+$smr (default C<SMRLog>).  Words must be added in sorted order; the
+builder merges equivalent states as it goes, so memory stays
+proportional to the minimal automaton rather than to the trie.
+
+=head3 C<$b-E<gt>add($word)>
+
+=head3 C<$b-E<gt>add(\@symbols)>
+
+Add a word, given either as a string of one-character symbols or as a
+list of symbols.  Dies if the word is out of order.
+
+=head3 C<$fst = $b-E<gt>finish>
+
+Return the acceptor of all words added so far, and empty the builder.
+
+=cut
+
+sub lexicon_builder
+{
+    Algorithm::OpenFST::LexiconBuilder->new(@_);
 }
+
+sub Algorithm::OpenFST::LexiconBuilder::add
+{
+    my ($b, $w) = @_;
+    $b->_add(ref $w ? $w : [split //, $w])
+        or die "lexicon_builder: word out of order\n";
 }
 
+## Supplementary methods
+package Algorithm::OpenFST::FST;
+
+use overload '""' => sub { shift->String };
+
 =head2 Acessors and Mutators
 
 =head3 C<$fst-E<gt>in>
@@ -295,6 +392,24 @@ sub add_arc_safe
     }
 }
 
+=head3 C<$sub = $fst-E<gt>prepare_difference>
+
+Return an unweighted, input-sorted copy of acceptor $fst with its
+properties computed.  C<Difference()> uses such an FST directly as
+its second argument instead of wrapping it in lazy weight-removing and
+sorting FSTs on every call, and several threads may subtract the same
+prepared FST at once as long as none of them modifies it.
+
+=cut
+
+sub prepare_difference
+{
+    my $ret = shift->RmWeight;
+    $ret->_ArcSort(Algorithm::OpenFST::INPUT);
+    $ret->Properties(1);
+    $ret;
+}
+
 sub _syms
 {
     my ($fst, $f) = @_;
@@ -307,24 +422,225 @@ sub _syms
     sort { $a <=> $b } keys %h;
 }
 
-=head3 C<$ofst = $fst-E<gt>best_paths($n [, $unique])>
+=head3 C<$ofst = $fst-E<gt>best_paths($n [, $unique [, $astar [, $threads]]])>
+
+Compute the best $n paths through $fst.  If $astar is true, search A*
+style, guided by each state's best cost to a final state: this table
+is computed on the first such search and kept on $fst until it is
+modified, so repeated queries against a large fixed FST only explore
+states near their best paths.  With $astar, a true $unique skips
+paths whose output repeats a better path's.  Without it, the
+library's ShortestPath searches instead.  It does not implement
+$unique (UNIMPLEMENTED), and on a tropical $fst with $n greater than
+1 it starts from the cached forward C<distances()>.  If $fst does not use the tropical semiring, it is
+directly converted to and from the tropical semiring; log-semiring
+FSTs are searched in place, without conversion.
+
+=head3 C<@outs = $fst-E<gt>transduce(\@input, n =E<gt> $k)>
+
+Transduce the symbols in @input (or labels, if $fst has no input
+symbol table; a symbol missing from the table is an error) by Viterbi
+search directly against $fst, without building an input acceptor or a
+composition.  Return up to $k (default 1) distinct outputs, cheapest
+first, each as C<[\@output_symbols, $cost]>, with weights treated as
+tropical costs.  The search structures are built on the first call
+and reused until $fst is modified, so repeated queries against a
+fixed $fst are cheap.
+
+=head3 C<$packed = $fst-E<gt>posteriors>
+
+Compute each arc's posterior probability in acyclic log-semiring
+$fst by forward-backward, and return them as a string of native
+floats, one per arc, ordered by state and then by arc.  Expected
+counts are then sums over the arcs of interest, without stringifying
+$fst.  To get a list of the posteriors:
+
+    my @post = unpack 'f*', $fst->posteriors;
+
+=head3 C<($out, $cost, $stats) = $fst-E<gt>beam_search(\@input, %opts)>
+
+Like C<transduce()>, but approximate: only tokens close to the best
+one for each input symbol are kept, so the time per symbol is bounded
+by the options rather than by the size of $fst.  Return the best
+output found as an arrayref of symbols with its cost, or two undefs
+if the beam lost every path, and a hashref of search statistics:
+B<created>, B<pruned> and B<expanded> tokens, and the B<pool> of
+token slots allocated, which are recycled once no path uses them.
+Options include:
+
+=over 4
+
+=item B<beam> -- Drop tokens costing more than this past the best one
+(default 10; negative for no limit).
+
+=item B<max_active> -- Keep at most this many states per input symbol,
+the cheapest (default 0, meaning no limit).  The limit is applied
+before following epsilon-input arcs as well as after, so it also
+bounds the states they are followed from.
+
+=back
+
+=head3 C<$it = $fst-E<gt>paths(%opts)>
+
+Enumerate the paths through $fst lazily, cheapest first, treating
+weights as tropical costs.  Each C<$it-E<gt>next> returns the next
+path's input and output labels, as arrayrefs of symbols without
+epsilons, and its cost, or the empty list when there are no more:
+
+    my $it = $fst->paths(unique => 1);
+    while (my ($in, $out, $cost) = $it->next) { ... }
+
+Only the paths taken are searched for, so it is cheap to stop early
+even on cyclic FSTs with endless paths.  With B<unique>, paths whose
+output repeats an earlier path's are skipped; beware that if there
+are infinitely many such paths, C<next> never returns.
+
+=head3 C<$ofst = $fst-E<gt>determinize(%opts)>
+
+Determinize $fst, which may be a weighted transducer.  Since some
+inputs blow up exponentially, options can bound the work:
+
+=over 4
+
+=item B<delta> -- Quantization for comparing weights (default 1.024e-3).
 
-Compute the best $n paths through $fst.  Compute unique paths if
-$unique is true (UNIMPLEMENTED).  If $fst does not use the tropical
-semiring, it is directly converted to and from the tropical semiring.
+=item B<max_states>, B<max_arcs> -- Die with "Determinize() stopped
+early" rather than build more states or arcs than this.
 
-=head3 C<$ofst = $fst-E<gt>prune($w)>
+=item B<threshold> -- Only build states on paths within I<threshold>
+of the best path, as C<prune()> would afterwards.  Weights are
+compared as tropical costs even on log-semiring FSTs, where the cost
+of the "best path" is that of all paths together, so the threshold
+keeps somewhat less than it would on the same tropical FST.  Real
+FSTs have no costs to compare, so die.
+
+=back
+
+With B<stats> true, C<determinize> returns C<($ofst, \%stats)>, where
+%stats has the result's B<states> and B<arcs>, the B<max_subset> and
+B<mean_subset> number of input states per output state, the subset
+table's B<collision_rate> (failed probes per lookup), and B<seconds>
+and B<states_per_second>.  The result is then not cached.
+
+=head3 C<$stats = $fst-E<gt>determinize_estimate(%opts)>
+
+Guess whether determinizing $fst will blow up, by building only its
+first B<sample> states (default 1000) breadth-first.  Returns the
+statistics above plus B<coverage>, the input states reached so far;
+B<growth>, the size of the last complete breadth-first level over the
+one before; B<predicted_states>; and B<blowup>, its ratio to $fst's
+size.  The prediction assumes that levels keep growing by B<growth>,
+and keep reaching new input states at the rate they have so far,
+until all of $fst is covered.  It is rough, but it does see
+exponential blowup coming.  A B<growth> above 1 with all input states
+covered means the result keeps forming new subsets of the same
+states, which the prediction cannot size.  B<complete> is true if the
+sample was the whole result, making the prediction exact.  Also takes
+B<delta>.
+
+=head3 C<$ofst = $fst-E<gt>Minimize($threads)>
+
+Minimize deterministic $fst.  With $threads greater than 1, this uses
+a partition refinement that splits blocks on up to $threads threads;
+the result is the same as with one thread.  Inputs that need many
+rounds of splitting, such as long chains, are finished on one thread.
+Acyclic FSTs such as word lists always take a faster linear-time path
+instead.
+
+=head3 C<$ofst = $fst-E<gt>RmEpsilon($delta, $threads)>
+
+Remove epsilon arcs, comparing weights to within $delta (default
+1.024e-3).  With $threads greater than 1, the states' epsilon
+closures are computed in parallel, from a flattened copy of $fst;
+beyond that copy, each thread only needs room for its largest
+closure.
+
+=head3 C<$ofst = $fst-E<gt>Reverse($lazy)>
+
+Reverse $fst.  If $lazy is true, the reversed arcs are only indexed
+when first read, and a full copy is made only if $ofst is modified.
+
+=head3 C<$ofst = $fst-E<gt>optimize(%opts)>
+
+=head3 C<($ofst, @stages) = $fst-E<gt>optimize(%opts)>
+
+Remove epsilons, determinize, minimize and arc-sort $fst in one call,
+encoding labels once for the whole pipeline.  In list context, also
+return one hash per stage with its B<stage> name, B<seconds>, and the
+B<states> and B<arcs> of its result.  Options:
+
+=over 4
+
+=item B<delta> -- Quantization for comparing weights (default 1.024e-3).
+
+=item B<threads> -- Threads for epsilon removal and minimization
+(default 1).
+
+=item B<sort> -- Sort arcs on their C<'input'> (default) or
+C<'output'> labels, for use as the right or left operand of
+C<Compose>.
+
+=back
+
+=head3 C<$ofst = $fst-E<gt>prune($w [, $threads])>
 
 Prune $fst so paths worse than $w from the best path are removed.
 
+=head3 C<@d = $fst-E<gt>distances($dir [, $threads])>
+
+Return each state's shortest distance from the start state if $dir
+is C<'forward'> (the default), or to the final states if it is
+C<'backward'>.  Both are computed on first use and kept until $fst is
+modified; C<Push>, C<Prune>, C<normalize> and C<ShortestPath> use the
+same tables, so querying an unchanged FST several ways only computes
+them once.
+
+With $threads greater than 1, the tables are computed in parallel:
+level by level for acyclic FSTs such as lattices, or by
+delta-stepping for cyclic tropical FSTs without negative weights.
+C<Push($type, $threads)>, C<Prune($w, $threads)>, C<prune($w,
+$threads)> and C<best_paths($n, $unique, $astar, $threads)> take the
+same option for the distances they need.
+
 =cut
 
+sub determinize
+{
+    my ($fst, %o) = @_;
+    my @args = (defined $o{delta} ? $o{delta} : 1.024e-3,
+                $o{max_states} || 0, $o{max_arcs} || 0,
+                defined $o{threshold} ? $o{threshold} : -1);
+    return $fst->_determinize_stats(@args) if $o{stats};
+    $fst->Determinize(@args);
+}
+
+sub determinize_estimate
+{
+    my ($fst, %o) = @_;
+    my $st = $fst->_determinize_estimate(
+        defined $o{delta} ? $o{delta} : 1.024e-3, $o{sample} || 1000);
+    $st->{blowup} = $fst->NumStates ? $st->{predicted_states} / $fst->NumStates
+        : 0;
+    $st;
+}
+
+sub optimize
+{
+    my ($fst, %o) = @_;
+    my ($ret, @stages) = $fst->_optimize(
+        defined $o{delta} ? $o{delta} : 1.024e-3, $o{threads} || 1,
+        ($o{sort} || '') eq 'output' ? Algorithm::OpenFST::OUTPUT
+            : Algorithm::OpenFST::INPUT);
+    wantarray ? ($ret, @stages) : $ret;
+}
+
 sub best_paths
 {
     my $fst = shift;
     my $smr = $fst->semiring;
     my $ret;
-    if ($smr == Algorithm::OpenFST::SMRTropical) {
+    if ($smr == Algorithm::OpenFST::SMRTropical
+        || $smr == Algorithm::OpenFST::SMRLog) {
         $ret = $fst->ShortestPath(@_);
     } else {
         $ret = $fst->change_semiring(Algorithm::OpenFST::SMRTropical)
@@ -334,19 +650,79 @@ sub best_paths
     $ret;
 }
 
+sub transduce
+{
+    my ($fst, $in, %o) = @_;
+    $fst->_transduce($in, $o{n} || 1);
+}
+
+sub beam_search
+{
+    my ($fst, $in, %o) = @_;
+    $fst->_beam_search($in, defined $o{beam} ? $o{beam} : 10,
+                       $o{max_active} || 0);
+}
+
+sub paths
+{
+    my ($fst, %o) = @_;
+    $fst->_paths($o{unique} ? 1 : 0);
+}
+
+sub string_iterator
+{
+    my ($fst, %o) = @_;
+    die "strings: cycles needs max_length\n" if $o{cycles} && !$o{max_length};
+    $fst->_string_iterator(($o{side} || '') eq 'output' ? 1 : 0,
+                           $o{max} || 0, $o{max_length} || 0,
+                           $o{cycles} ? 1 : 0);
+}
+
+sub strings
+{
+    my ($fst, %o) = @_;
+    my $it = $fst->string_iterator(%o);
+    my $sep = $o{labels} ? undef : defined $o{sep} ? $o{sep} : ' ';
+    my @ret;
+    while (my @chunk = $it->_next(1000, $sep)) {
+        push @ret, @chunk;
+    }
+    @ret;
+}
+
+sub Algorithm::OpenFST::StringIterator::next
+{
+    my ($it, $n, $sep) = @_;
+    $it->_next($n || 1, defined $sep ? $sep : ' ');
+}
+
+sub Algorithm::OpenFST::StringIterator::next_labels
+{
+    my ($it, $n) = @_;
+    $it->_next($n || 1, undef);
+}
+
+sub distances
+{
+    my ($fst, $dir, $threads) = @_;
+    $fst->_distances(($dir || 'forward') eq 'backward' ? 1 : 0,
+                     $threads || 1);
+}
+
 sub prune
 {
     my $fst = shift;
     my $smr = $fst->semiring;
     my $ret;
     if ($smr == Algorithm::OpenFST::SMRTropical) {
-        $ret = $fst->_Prune(@_);
+        $ret = $fst->Prune(@_);
     } else {
         $ret = $fst->change_semiring(Algorithm::OpenFST::SMRTropical)
-            ->Prune(@_)->change_semiring($smr);
+            ->Prune(@_)->change_semiring(Algorithm::OpenFST::SMRLog);
     }
+    ## In the log semiring, since a cyclic real FST has no distances.
     $ret->normalize;
-    $ret;
+    $smr == Algorithm::OpenFST::SMRReal ? $ret->change_semiring($smr) : $ret;
 }
 
 1;
@@ -354,7 +730,39 @@ __END__
 
 =head3 C<$fst-E<gt>normalize>
 
-=head3 C<@strings = $fst-E<gt>strings>
+=head3 C<@strings = $fst-E<gt>strings(%opts)>
+
+Return the strings of $fst's successful paths in depth-first order,
+as symbols joined by spaces, without epsilons; paths through a final
+state yield its string and continue past it.  A path never visits a
+state twice unless B<cycles> is given, so every FST has finitely many
+strings.  They are enumerated in C++ and passed to Perl a chunk at a
+time.  Options include:
+
+=over 4
+
+=item B<max> -- Stop after this many strings.
+
+=item B<max_length> -- Follow paths of at most this many arcs.
+
+=item B<cycles> -- Let paths go round cycles, up to B<max_length>,
+which is then required.
+
+=item B<side> -- C<'output'> for output labels rather than input.
+
+=item B<sep> -- Separator between symbols (default C<' '>).
+
+=item B<labels> -- Return arrayrefs of symbols instead of strings.
+
+=back
+
+=head3 C<$it = $fst-E<gt>string_iterator(%opts)>
+
+Enumerate the strings of C<strings(%opts)> on demand.
+C<$it-E<gt>next($n, $sep)> returns up to $n (default 1) more strings,
+and C<$it-E<gt>next_labels($n)> arrayrefs of symbols, or the empty
+list when there are no more.  C<$it-E<gt>truncated> is then true if a
+limit or a cycle left some paths out.
 
 =head3 C<@syms = $fstE<gt>in_syms>
 
@@ -1,13 +1,338 @@
+#include <cmath>
 #include <sstream>
 #include <fstream>
+#include <list>
+#include <sys/time.h>
 #include "openfst-pre.h"
 #include "openfst.h"
 #include "openfst-io.h"
 #include "markovize.h"
+#include "threads.h"
+#include "shared-fst.h"
+#include "fingerprint.h"
+#include "bounded-determinize.h"
+#include "refine.h"
+#include "acyclic-minimize.h"
+#include "lexicon.h"
+#include "eps-removal.h"
+#include "lazy-fst.h"
+#include "path-iterator.h"
+#include "parallel-distance.h"
+#include "decoder.h"
+#include "posteriors.h"
+#include "string-enumerator.h"
+#include "real-weight.h"
 
 using namespace std;
 using namespace fst;
 
+//////////////////////////////////////////////////////////////////////
+// Symbol table fingerprints
+
+// OpenFST keeps an MD5 checksum of every symbol table, recomputed
+// only after a symbol is added.  Comparing checksums instead of whole
+// tables makes the check cheap, and since the checksum lives in the
+// table itself it can never describe some other table.
+static uint64
+symtab_fingerprint(const SymbolTable * st)
+{
+    const string sum = st->CheckSum();
+    uint64 h = 14695981039346656037ULL;
+    for (size_t i = 0; i < sum.size(); i++)
+        h = (h ^ (unsigned char)sum[i]) * 1099511628211ULL;
+    return h;
+}
+
+static bool
+compat_symbols(const SymbolTable * a, const SymbolTable * b)
+{
+    if (!a || !b || a == b)
+        return true;
+    return a->CheckSum() == b->CheckSum();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Result cache
+
+// An opt-in LRU memo of Compose, Intersect, Difference and
+// Determinize, keyed by the operands' content fingerprints.  Cached
+// FSTs are never handed out themselves: a hit returns a Copy(), which
+// shares the cached VectorFst until one side is modified.
+
+enum { CACHE_COMPOSE, CACHE_INTERSECT, CACHE_DIFFERENCE, CACHE_DETERMINIZE };
+
+struct cache_key
+{
+    bool valid;
+    int op, smr;
+    uint64 a, b;
+    uint32 param;
+    // Operand sizes, checked along with the prints so that a hash
+    // collision cannot match FSTs of a different shape.
+    int64 states_a, arcs_a, states_b, arcs_b;
+
+    cache_key()
+        : valid(false), op(0), smr(0), a(0), b(0), param(0),
+          states_a(0), arcs_a(0), states_b(0), arcs_b(0) { }
+    uint64 hash() const
+        {
+            return hash_mix(hash_mix(hash_mix(hash_mix(op, smr), a), b),
+                            param);
+        }
+    bool operator==(const cache_key& k) const
+        {
+            return op == k.op && smr == k.smr && a == k.a && b == k.b
+                && param == k.param
+                && states_a == k.states_a && arcs_a == k.arcs_a
+                && states_b == k.states_b && arcs_b == k.arcs_b;
+        }
+};
+
+class result_cache
+{
+    typedef list<pair<cache_key, FST *> > lru_t;
+    lru_t lru;                  // most recently used first
+    hash_map<size_t, lru_t::iterator> index;
+    size_t max;
+    unsigned long hits, misses;
+    pthread_mutex_t lock;
+
+    void evict(lru_t::iterator it)
+        {
+            index.erase((size_t)it->first.hash());
+            delete it->second;
+            lru.erase(it);
+        }
+
+public:
+    result_cache() : max(0), hits(0), misses(0)
+        { pthread_mutex_init(&lock, NULL); }
+    ~result_cache()
+        {
+            resize(0);
+            pthread_mutex_destroy(&lock);
+        }
+
+    bool enabled() const
+        { return max > 0; }
+
+    /// A copy of the result cached under K, or NULL.
+    FST * find(const cache_key& k)
+        {
+            if (!k.valid || !enabled())
+                return NULL;
+            FST * ret = NULL;
+            pthread_mutex_lock(&lock);
+            hash_map<size_t, lru_t::iterator>::iterator i
+                = index.find((size_t)k.hash());
+            if (i != index.end() && i->second->first == k) {
+                lru.splice(lru.begin(), lru, i->second);
+                ret = i->second->second->Copy();
+                ++hits;
+            } else {
+                ++misses;
+            }
+            pthread_mutex_unlock(&lock);
+            return ret;
+        }
+
+    /// Remember a copy of RESULT under K.
+    void insert(const cache_key& k, const FST * result)
+        {
+            if (!k.valid || !enabled() || !result)
+                return;
+            pthread_mutex_lock(&lock);
+            hash_map<size_t, lru_t::iterator>::iterator i
+                = index.find((size_t)k.hash());
+            if (i != index.end())
+                evict(i->second);
+            lru.push_front(make_pair(k, result->Copy()));
+            index[(size_t)k.hash()] = lru.begin();
+            while (lru.size() > max)
+                evict(--lru.end());
+            pthread_mutex_unlock(&lock);
+        }
+
+    void resize(size_t n)
+        {
+            pthread_mutex_lock(&lock);
+            max = n;
+            while (lru.size() > max)
+                evict(--lru.end());
+            pthread_mutex_unlock(&lock);
+        }
+
+    void stats(unsigned long& h, unsigned long& m, unsigned long& n,
+               unsigned long& sz)
+        {
+            pthread_mutex_lock(&lock);
+            h = hits;
+            m = misses;
+            n = lru.size();
+            sz = max;
+            pthread_mutex_unlock(&lock);
+        }
+};
+
+static result_cache memo;
+
+/// Cache key for OP applied to A (and B) with PARAM, or an invalid
+/// key if caching is off or an operand cannot be fingerprinted.
+/// Every op but Determinize needs B; a NULL B (e.g. an operand that
+/// is not an FSTImpl) gets an invalid key.
+template <class Impl>
+cache_key
+memo_key(int op, const Impl * a, const Impl * b = NULL, float param = 0)
+{
+    cache_key k;
+    bool binary = op != CACHE_DETERMINIZE;
+    if (!memo.enabled() || !a || (binary && !b))
+        return k;
+    k.valid = true;
+    k.op = op;
+    k.smr = a->semiring();
+    k.a = a->fingerprint();
+    a->shape(k.states_a, k.arcs_a);
+    if (binary) {
+        k.b = b->fingerprint();
+        b->shape(k.states_b, k.arcs_b);
+    }
+    k.param = float_bits(param);
+    return k;
+}
+
+// Copies of whole FSTs, for copy_count().
+static unsigned long ncopies;
+
+/// A copy of F.  FSTImpl makes every copy of its FST through this,
+/// so that copy_count() shows which operations avoid copying.
+template <class F>
+static F *
+counted_copy(const F& f)
+{
+    ncopies++;
+    return f.Copy();
+}
+
+unsigned long
+copy_count()
+{
+    return ncopies;
+}
+
+void
+cache_size(int n)
+{
+    memo.resize(n > 0 ? n : 0);
+}
+
+void
+cache_stats(unsigned long& hits, unsigned long& misses,
+            unsigned long& entries, unsigned long& size)
+{
+    memo.stats(hits, misses, entries, size);
+}
+
+template <class Arc>
+static void
+rm_epsilon(MutableFst<Arc> * fst, float delta, int threads)
+{
+    if (threads > 1) {
+        EpsilonRemover<Arc>(*fst, delta).run(fst, threads);
+        return;
+    }
+    vector<typename Arc::Weight> d;
+    AutoQueue<typename Arc::StateId> queue(*fst, &d, EpsilonArcFilter<Arc>());
+    RmEpsilonOptions<Arc, AutoQueue<typename Arc::StateId> >
+        opts(&queue, delta, true);
+    RmEpsilon(fst, &d, opts);
+}
+
+/// Remove FST's arcs and final weights on paths costing more than
+/// THRESHOLD over the best, given its forward and backward shortest
+/// distances ALPHA and BETA in a path semiring such as tropical.
+template <class Arc>
+static void
+prune(MutableFst<Arc> * fst, const vector<typename Arc::Weight>& alpha,
+      const vector<typename Arc::Weight>& beta, float threshold)
+{
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Weight Weight;
+    float inf = Weight::Zero().Value();
+    StateId n = fst->NumStates(), start = fst->Start();
+    if (start == kNoStateId || (size_t)start >= beta.size())
+        return;
+    float limit = beta[start].Value() + threshold;
+    vector<Arc> keep;
+    for (StateId s = 0; s < n; s++) {
+        float a = (size_t)s < alpha.size() ? alpha[s].Value() : inf;
+        if (a + fst->Final(s).Value() > limit)
+            fst->SetFinal(s, Weight::Zero());
+        keep.clear();
+        for (ArcIterator<MutableFst<Arc> > ai(*fst, s); !ai.Done(); ai.Next()) {
+            const Arc& arc = ai.Value();
+            float b = (size_t)arc.nextstate < beta.size()
+                ? beta[arc.nextstate].Value() : inf;
+            if (a + arc.weight.Value() + b <= limit)
+                keep.push_back(arc);
+        }
+        if (keep.size() == fst->NumArcs(s))
+            continue;
+        fst->DeleteArcs(s);
+        for (size_t i = 0; i < keep.size(); i++)
+            fst->AddArc(s, keep[i]);
+    }
+    Connect(fst);
+}
+
+template <class Arc>
+void best_paths(const fst::Fst<Arc>& , MutableFst<Arc> * , unsigned , bool );
+template <>
+void best_paths(const fst::Fst<LogArc>& , MutableFst<LogArc> * ,
+                unsigned , bool );
+
+/// Tables derived from an FST's contents, built on first use and
+/// dropped when it changes.
+template <class Arc>
+struct derived_tables
+{
+    vector<float> future;           // A* heuristic for ShortestPath()
+    bool have_future;
+    // Forward and backward shortest distances
+    vector<typename Arc::Weight> dist[2];
+    bool have_dist[2];
+    DecodeGraph<Arc> * graph;       // for transduce()
+    TokenDecoder<Arc> * decoder;
+
+    derived_tables()
+        : have_future(false), graph(NULL), decoder(NULL)
+        { have_dist[0] = have_dist[1] = false; }
+    ~derived_tables()
+        { clear(); }
+
+    void clear()
+        {
+            if (have_future) {
+                vector<float>().swap(future);
+                have_future = false;
+            }
+            for (int i = 0; i < 2; i++) {
+                if (have_dist[i]) {
+                    vector<typename Arc::Weight>().swap(dist[i]);
+                    have_dist[i] = false;
+                }
+            }
+            delete decoder;
+            delete graph;
+            decoder = NULL;
+            graph = NULL;
+        }
+
+private:
+    derived_tables(const derived_tables& ); // disallow
+    void operator=(const derived_tables& );
+};
+
 //////////////////////////////////////////////////////////////////////
 // FST Impls
 template <typename Arc>
@@ -16,23 +341,148 @@ struct FSTImpl : public FSTBase<Arc>
     typedef fst::MutableFst<Arc> Fst;
 
     Fst * fst;
+    // Content fingerprint, valid while have_print is set.
+    mutable uint64 print;
+    mutable bool have_print;
+    mutable derived_tables<Arc> derived;
 
-    FSTImpl() : fst(NULL) { }
+    FSTImpl() : fst(NULL), have_print(false) { }
     ~FSTImpl()
         { delete fst; }
 
     FSTImpl(const char * file)
+        : have_print(false)
         {
             fst = Fst::Read(file);
         }
 
     FSTImpl(const Fst& f)
-        : fst(f.Copy()) { }
+        : fst(counted_copy(f)), have_print(false) { }
     FSTImpl(Fst * f)
-        : fst(f) { }
+        : fst(f), have_print(false) { }
 
     FSTImpl(const FSTImpl& f)
-        : fst(f.fst->Copy()) { }
+        : fst(counted_copy(*f.fst)), print(f.print),
+          have_print(f.have_print) { }
+
+    /// Call after changing the FST to drop anything cached about it.
+    void touched()
+        {
+            have_print = false;
+            derived.clear();
+        }
+    uint64 fingerprint() const;
+    void shape(int64& states, int64& arcs) const
+        {
+            states = fst->NumStates();
+            arcs = 0;
+            for (int64 i = 0; i < states; i++)
+                arcs += fst->NumArcs(i);
+        }
+    /// Shortest distances from the start state, or if REVERSE, to
+    /// the final states, computed once, on up to THREADS threads.
+    const vector<typename Arc::Weight>& potentials(bool reverse,
+                                                   int threads = 1) const
+        {
+            derived_tables<Arc>& d = derived;
+            if (!d.have_dist[reverse]) {
+                parallel_distance(*fst, &d.dist[reverse], reverse, threads,
+                                  semiring() == SMRTropical);
+                d.have_dist[reverse] = true;
+            }
+            return d.dist[reverse];
+        }
+    /// Croak unless WHAT can treat the weights as costs, or if SUMS,
+    /// unless it can sum them over all paths: in the real semiring,
+    /// sums over cycles need not converge.
+    void check_semiring(const char * what, bool sums = false) const
+        {
+            if (semiring() != SMRReal)
+                return;
+            if (!sums)
+                croak("%s needs a log or tropical FST", what);
+            if (!fst->Properties(kAcyclic, true))
+                croak("%s needs an acyclic FST in the real semiring", what);
+        }
+    virtual void distances(bool reverse, vector<float>& out,
+                           int threads) const
+        {
+            check_semiring("distances()", true);
+            const vector<typename Arc::Weight>& d
+                = potentials(reverse, threads);
+            out.assign(fst->NumStates(), Arc::Weight::Zero().Value());
+            for (size_t i = 0; i < d.size() && i < out.size(); i++)
+                out[i] = d[i].Value();
+        }
+    /// Each state's best cost to a final state, computed once.  In
+    /// the tropical semiring, that is just the backward distance.
+    const vector<float>& heuristic(int threads = 1) const
+        {
+            derived_tables<Arc>& d = derived;
+            if (!d.have_future) {
+                if (semiring() == SMRTropical)
+                    distances(true, d.future, threads);
+                else
+                    future_costs(*fst, &d.future);
+                d.have_future = true;
+            }
+            return d.future;
+        }
+    /// The decoder for transduce(), built on first use.
+    TokenDecoder<Arc> * decoder() const
+        {
+            derived_tables<Arc>& d = derived;
+            if (!d.decoder) {
+                d.graph = new DecodeGraph<Arc>(*fst);
+                d.decoder = new TokenDecoder<Arc>(*d.graph);
+            }
+            return d.decoder;
+        }
+    virtual void transduce(const vector<int>& in, unsigned n,
+                           vector<pair<vector<int>, float> >& out) const
+        {
+            check_semiring("transduce()");
+            decoder()->decode(in, n, out);
+        }
+    virtual void posteriors(vector<float>& out) const
+        {
+            if (semiring() != SMRLog)
+                croak("posteriors() needs a log-semiring FST");
+            if (!ArcPosteriors<Arc>(*fst).run(&out))
+                croak("posteriors() needs an acyclic FST");
+        }
+    virtual bool beam_search(const vector<int>& in, float beam,
+                             unsigned max_active, vector<int>& out,
+                             float& cost, decode_stats * stats) const
+        {
+            check_semiring("beam_search()");
+            TokenDecoder<Arc> * dec = decoder();
+            vector<pair<vector<int>, float> > best;
+            dec->decode(in, 1, best, beam, max_active);
+            if (stats) {
+                stats->created = dec->Created();
+                stats->pruned = dec->Pruned();
+                stats->expanded = dec->Expanded();
+                stats->pool = dec->PoolSize();
+            }
+            if (best.empty())
+                return false;
+            out.swap(best[0].first);
+            cost = best[0].second;
+            return true;
+        }
+    virtual void transduce_batch(
+        const vector<vector<int> >& in, unsigned n, int threads,
+        vector<vector<pair<vector<int>, float> > >& out) const
+        {
+            check_semiring("decode_batch()");
+            TokenDecoder<Arc> * first = decoder();
+            try {
+                decode_batch(*derived.graph, first, in, n, threads, out);
+            } catch (fst_exception& e) {
+                croak("decode_batch: %s", e.what());
+            }
+        }
 
     virtual FST * Copy() const
         { return new FSTImpl(*this); }
@@ -49,77 +499,126 @@ struct FSTImpl : public FSTBase<Arc>
     virtual FST * Compose(FST * that) const;
     virtual FST * Intersect(FST * that) const;
     virtual FST * Difference(FST * that) const;
+    virtual void compose_batch(const vector<FST *>& in, int threads,
+                               unsigned nbest, vector<FST *>& out) const;
     virtual void _Union(const FST * that)
         {
             const FSTBase<Arc> * f = dynamic_cast<const FSTBase<Arc>*>(that);
             if (f)
                 fst::Union(fst, *f->get_fst());
+            touched();
         }
     virtual void _Concat(const FST * that)
         {
             const FSTBase<Arc> * f = dynamic_cast<const FSTBase<Arc>*>(that);
             if (f)
                 fst::Concat(fst, *f->get_fst());
+            touched();
         }
 
     // Transformation
     virtual void _Closure(int type)
-        { fst::Closure(fst, (fst::ClosureType)type); }
+        {
+            fst::Closure(fst, (fst::ClosureType)type);
+            touched();
+        }
 
     virtual void _Project(int type)
-        { fst::Project(fst, (fst::ProjectType)type); }
+        {
+            fst::Project(fst, (fst::ProjectType)type);
+            touched();
+        }
 
     virtual void _Encode(int type);
     virtual void _Decode(int type);
 
-    virtual FST * Reverse() const;
+    virtual FST * Reverse(bool) const;
     virtual void _Invert()
-        { fst::Invert(fst); }
+        {
+            fst::Invert(fst);
+            touched();
+        }
+    // Arc order does not affect anything cached, so no touched().
+    virtual void _ArcSort(int type)
+        {
+            if (type == OUTPUT)
+                ArcSort(fst, OLabelCompare<Arc>());
+            else
+                ArcSort(fst, ILabelCompare<Arc>());
+        }
+    virtual void _RmWeight()
+        {
+            RmWeightMapper<Arc> rm;
+            Map(fst, &rm);
+            touched();
+        }
 
     // Cleanup
     // XXX: why only some destructive?
-    virtual FST * Determinize(float) const;
-    virtual void _RmEpsilon(float delta)
+    virtual FST * Determinize(float, int, int, float, det_stats *) const;
+    virtual void determinize_estimate(float, int, det_stats& ) const;
+    virtual void _RmEpsilon(float delta, int threads)
         {
             try {
-                vector<typename Arc::Weight> d;
-                AutoQueue<typename Arc::StateId>
-                    queue(*fst, &d, EpsilonArcFilter<Arc>());
-                RmEpsilonOptions<Arc, AutoQueue<typename Arc::StateId> >
-                    opts(&queue, delta, true);
-                RmEpsilon(fst, &d, opts);
+                rm_epsilon(fst, delta, threads);
             } catch (fst_exception e) {
+                touched();
                 croak("%s", e.what());
             }
+            touched();
         }
     virtual FST * EpsNormalize(int ) const;
-    virtual void _Minimize();
-    virtual FST * Minimize() const;
+    virtual FST * optimize(float delta, int threads, int sort,
+                           vector<stage_stats>& stats) const;
+    virtual void _Minimize(int threads, bool general);
+    virtual FST * Minimize(int threads) const;
 
-    virtual void _Prune(float w)
+    virtual void _Prune(float w, int threads)
         {
-            Prune(fst, w);
+            check_semiring("Prune()");
+            if (semiring() == SMRTropical)
+                prune(fst, potentials(false, threads),
+                      potentials(true, threads), w);
+            else
+                Prune(fst, w);
+            touched();
         }
 
-    virtual void _Push(int type)
+    virtual void _Push(int type, int threads)
         {
-            Push(fst, (fst::ReweightType)type);
+            check_semiring("Push()", true);
+            // What fst::Push does, but with the cached distances.
+            Reweight(fst, potentials(type == INITIAL, threads),
+                     (fst::ReweightType)type);
+            touched();
         }
     virtual void normalize();
     virtual FST * markovize(int ) const;
 
     virtual void AddState()
-        { fst->AddState(); }
+        {
+            fst->AddState();
+            touched();
+        }
     virtual void SetStart(int i)
-        { fst->SetStart(i); }
+        {
+            fst->SetStart(i);
+            touched();
+        }
     virtual int Start() const
         { return fst->Start(); }
     virtual void SetFinal(int i, float w = 0)
-        { fst->SetFinal(i, w); }
+        {
+            fst->SetFinal(i, w);
+            touched();
+        }
     virtual float Final(int i) const
         { return fst->Final(i).Value(); }
     virtual void AddArc(int from, int to, float w, int in, int out)
-        { fst->AddArc(from, Arc(in, out, w, to)); }
+        {
+            fst->AddArc(from, Arc(in, out, w, to));
+            touched();
+        }
 
     void init_symtab() const
         {
@@ -136,12 +635,14 @@ struct FSTImpl : public FSTBase<Arc>
         {
             if (!fst->InputSymbols())
                 init_symtab();
+            touched();
             return ((SymbolTable*)fst->InputSymbols())->AddSymbol(string(s));
         }
     virtual int add_output_symbol(const char * s)
         {
             if (!fst->OutputSymbols())
                 init_symtab();
+            touched();
             return ((SymbolTable*)fst->OutputSymbols())->AddSymbol(string(s));
         }
 
@@ -173,8 +674,7 @@ struct FSTImpl : public FSTBase<Arc>
 
     virtual int NumStates() const
         {
-            VectorFst<Arc> * v = dynamic_cast<VectorFst<Arc>*>(fst);
-            return v ? (int)v->NumStates() : -1;
+            return fst->NumStates();
         }
 
     virtual int NumArcs(unsigned st) const
@@ -187,27 +687,62 @@ struct FSTImpl : public FSTBase<Arc>
         {
             return fst->Properties(0xffffffff, compute);
         }
-    virtual FST * ShortestPath(unsigned n, int uniq) const
+    virtual FST * ShortestPath(unsigned n, int uniq, bool astar,
+                               int threads) const
         {
+            check_semiring("ShortestPath()");
             FSTImpl * ret = new FSTImpl<Arc>(new VectorFst<Arc>);
             try {
-                fst::ShortestPath(*fst, ret->fst, n, uniq);
+                if (astar) {
+                    astar_paths(*fst, heuristic(threads), n, uniq, ret->fst);
+                    ret->fst->SetInputSymbols(fst->InputSymbols());
+                    ret->fst->SetOutputSymbols(fst->OutputSymbols());
+                } else if (semiring() == SMRTropical && n > 1 && !uniq) {
+                    // The library's n-best search starts from the
+                    // forward distances, so hand it the cached ones.
+                    typedef AutoQueue<typename Arc::StateId> Queue;
+                    vector<typename Arc::Weight> d(potentials(false,
+                                                              threads));
+                    AnyArcFilter<Arc> filter;
+                    Queue queue(*fst, &d, filter);
+                    ShortestPathOptions<Arc, Queue, AnyArcFilter<Arc> >
+                        opts(&queue, filter, n, false, true);
+                    fst::ShortestPath(*fst, ret->fst, &d, opts);
+                } else {
+                    best_paths(*fst, ret->fst, n, uniq);
+                }
                 return ret;
             } catch (fst_exception e) {
                 delete ret;
                 croak(e.what());
             }
         }
-    void _strings(vector<string>& out, int st, const string& cur) const;
-    virtual void strings(vector<string>&) const;
+    virtual PathIterator * paths(bool unique) const
+        {
+            check_semiring("paths()");
+            return new PathEnumerator<Arc>(counted_copy(*fst), unique);
+        }
+    virtual StringIterator * string_iterator(bool output, size_t max_count,
+                                             size_t max_length,
+                                             bool cycles) const
+        {
+            return new StringEnumerator<Arc>(counted_copy(*fst), output,
+                                             max_count, max_length, cycles);
+        }
     virtual SymbolTable * InputSymbols() const
         { return (SymbolTable *)fst->InputSymbols(); }
     virtual SymbolTable * OutputSymbols() const
         { return (SymbolTable *)fst->OutputSymbols(); }
     virtual void SetInputSymbols(const SymbolTable * s)
-        { fst->SetInputSymbols(s); }
+        {
+            fst->SetInputSymbols(s);
+            touched();
+        }
     virtual void SetOutputSymbols(const SymbolTable * s)
-        { fst->SetOutputSymbols(s); }
+        {
+            fst->SetOutputSymbols(s);
+            touched();
+        }
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -219,6 +754,9 @@ FSTImpl<Arc>::Intersect(FST * that) const
 {
     const FSTImpl * f = dynamic_cast<const FSTImpl<Arc>*>(that);
     if (f) {
+        cache_key key = memo_key(CACHE_INTERSECT, this, f);
+        if (FST * hit = memo.find(key))
+            return hit;
         // XXX: maybe encode and try again here?
         if (!fst->Properties(kAcceptor, true))
             return NULL;
@@ -230,6 +768,7 @@ FSTImpl<Arc>::Intersect(FST * that) const
         // XXX: stupid copy
         FSTImpl<Arc> * ret = new FSTImpl<Arc>(new VectorFst<Arc>);
         fst::Intersect(*(const Fst*)fst, *f->fst, ret->fst);
+        memo.insert(key, ret);
         return ret;
     }
     return NULL;
@@ -248,75 +787,332 @@ FSTImpl<Arc>::Compose(FST * that) const
 {
     FSTImpl * f;
     CAST_OR_CROAK(f, that, FSTImpl<Arc>*);
-    if (!CompatSymbols(fst->OutputSymbols(), f->fst->InputSymbols())) {
-        cerr << "incompatible symbol tables in Compose()" << endl;
-        if (fst->OutputSymbols())
-            fst->OutputSymbols()->WriteText(cerr);
-        else
-            cerr << "<NULL>" << endl;
-        if (f->fst->InputSymbols())
-            f->fst->InputSymbols()->WriteText(cerr);
-        else
-            cerr << "<NULL>" << endl;
-        return NULL;
-    }
+    if (!compat_symbols(fst->OutputSymbols(), f->fst->InputSymbols()))
+        croak("incompatible symbol tables in Compose()");
+    cache_key key = memo_key(CACHE_COMPOSE, this, f);
+    if (FST * hit = memo.find(key))
+        return hit;
     ArcSort(f->fst, ILabelCompare<Arc>());
     ArcSort(fst, OLabelCompare<Arc>());
     // XXX: stupid copy
     FSTImpl<Arc> * ret = new FSTImpl<Arc>(new VectorFst<Arc>);
-    // Feeding my output into his input.
-    if (fst->OutputSymbols() || f->fst->InputSymbols()) {
-        SymbolTable * rst = new SymbolTable("");
-        if (fst->OutputSymbols())
-            rst->AddTable(*fst->OutputSymbols());
-        if (f->fst->InputSymbols())
-            rst->AddTable(*f->fst->InputSymbols());
-        ret->fst->SetInputSymbols(fst->InputSymbols());
-        ret->fst->SetOutputSymbols(f->fst->OutputSymbols());
-    }
+    // Feeding my output into his input: the tables in the middle are
+    // compatible, so the result just keeps the outer ones.
+    ret->fst->SetInputSymbols(fst->InputSymbols());
+    ret->fst->SetOutputSymbols(f->fst->OutputSymbols());
     fst::Compose(*(const Fst*)fst, *f->fst, ret->fst);
+    memo.insert(key, ret);
     return ret;
 }
 
+/// Arc-by-arc conversion between semirings with float weights.
+template <class A, class B>
+struct semiring_mapper
+{
+    B operator()(const A& a) const
+        { return B(a.ilabel, a.olabel, a.weight.Value(), a.nextstate); }
+    MapFinalAction FinalAction() const
+        { return MAP_NO_SUPERFINAL; }
+    uint64 Properties(uint64 props) const
+        { return props; }
+};
+
+/// The N best paths of IFST.  Only path semirings can do this
+/// directly; others are searched in the tropical semiring.
+template <class Arc>
+void
+best_paths(const fst::Fst<Arc>& ifst, MutableFst<Arc> * ofst,
+           unsigned n, bool uniq)
+{
+    fst::ShortestPath(ifst, ofst, n, uniq);
+}
+
+template <>
+void
+best_paths(const fst::Fst<LogArc>& ifst, MutableFst<LogArc> * ofst,
+           unsigned n, bool uniq)
+{
+    VectorFst<StdArc> out;
+    if (const VectorFst<LogArc> * v
+        = dynamic_cast<const VectorFst<LogArc> *>(&ifst)) {
+        fst::ShortestPath(SemiringView<LogArc, StdArc>(*v), &out, n, uniq);
+    } else {
+        VectorFst<StdArc> in;
+        Map(ifst, &in, semiring_mapper<LogArc, StdArc>());
+        fst::ShortestPath(in, &out, n, uniq);
+    }
+    *ofst = SemiringView<StdArc, LogArc>(out);
+}
+
+template <class Arc>
+struct compose_job
+{
+    const vector<SharedFst<Arc> *>& in;
+    const SharedFst<Arc>& big;
+    vector<VectorFst<Arc> *>& out;
+    unsigned nbest;
+
+    compose_job(const vector<SharedFst<Arc> *>& i, const SharedFst<Arc>& b,
+                vector<VectorFst<Arc> *>& o, unsigned n)
+        : in(i), big(b), out(o), nbest(n) { }
+    void operator()(int i, int)
+        {
+            out[i] = new VectorFst<Arc>;
+            fst::Compose(*in[i], big, out[i]);
+            if (nbest) {
+                // out[i] keeps the full composition until the paths are
+                // in, so a throw leaves nothing for the caller to leak.
+                VectorFst<Arc> * paths = new VectorFst<Arc>;
+                try {
+                    best_paths(*out[i], paths, nbest, false);
+                } catch (...) {
+                    delete paths;
+                    throw;
+                }
+                delete out[i];
+                out[i] = paths;
+            }
+        }
+};
+
+template <class Arc>
+void
+FSTImpl<Arc>::compose_batch(const vector<FST *>& that, int threads,
+                            unsigned nbest, vector<FST *>& ret) const
+{
+    vector<FSTImpl *> in(that.size());
+    for (size_t i = 0; i < that.size(); i++) {
+        CAST_OR_CROAK(in[i], that[i], FSTImpl<Arc>*);
+        if (!compat_symbols(in[i]->fst->OutputSymbols(), fst->InputSymbols()))
+            croak("incompatible symbol tables in compose_batch()");
+    }
+    // Sort everything and compute properties up front; after that the
+    // workers only read their operands.
+    ArcSort(fst, ILabelCompare<Arc>());
+    SharedFst<Arc> big(*fst);
+    vector<SharedFst<Arc> *> views(in.size());
+    for (size_t i = 0; i < in.size(); i++) {
+        ArcSort(in[i]->fst, OLabelCompare<Arc>());
+        views[i] = new SharedFst<Arc>(*in[i]->fst);
+    }
+    vector<VectorFst<Arc> *> out(in.size(), (VectorFst<Arc> *)NULL);
+    compose_job<Arc> job(views, big, out, nbest);
+    string error;
+    try {
+        parallel_for(in.size(), threads, job);
+    } catch (fst_exception& e) {
+        error = e.what();
+    }
+    for (size_t i = 0; i < in.size(); i++)
+        delete views[i];
+    if (!error.empty()) {
+        for (size_t i = 0; i < out.size(); i++)
+            delete out[i];
+        croak("compose_batch: %s", error.c_str());
+    }
+    // Symbol tables are reference-counted too, so attach them here
+    // rather than in the workers.
+    ret.resize(out.size());
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i]->SetInputSymbols(in[i]->fst->InputSymbols());
+        out[i]->SetOutputSymbols(fst->OutputSymbols());
+        ret[i] = new FSTImpl<Arc>(out[i]);
+    }
+}
+
 template <class Arc>
 FST *
 FSTImpl<Arc>::Difference(FST * that) const
 {
     FSTBase<Arc> * f;
     CAST_OR_CROAK(f, that, FSTBase<Arc>*);
+    // A subtrahend already known to be an unweighted, input-sorted
+    // acceptor (see prepare_difference()) is used as-is.  Only reading
+    // known properties keeps this safe to share between threads.
+    const uint64 ready = kAcceptor | kUnweighted | kILabelSorted;
+    uint64 props = f->get_fst()->Properties(kFstProperties, false);
+    bool prepared = (props & ready) == ready;
     if (!get_fst()->Properties(kAcceptor, true)
-        || !f->get_fst()->Properties(kAcceptor, true))
+        || (!prepared && !f->get_fst()->Properties(kAcceptor, true)))
         return NULL;
+    cache_key key = memo_key(CACHE_DIFFERENCE, this,
+                             dynamic_cast<const FSTImpl *>(f));
+    if (FST * hit = memo.find(key))
+        return hit;
     VectorFst<Arc> * ret = new VectorFst<Arc>;
-    // Stupid library requires second FST to be unweighted.
-    ArcSortFst<Arc, ILabelCompare<Arc> > tmp(
-        MapFst<Arc, Arc, RmWeightMapper<Arc> >(
-            *f->get_fst(), RmWeightMapper<Arc>()),
-        ILabelCompare<Arc>());
-    fst::Difference(*get_fst(), tmp, ret);
-    return new FSTImpl<Arc>(ret);
+    if (prepared) {
+        fst::Difference(*get_fst(), SharedFst<Arc>(*f->get_fst(), props), ret);
+        // The view has no symbol tables; an acceptor's output side
+        // is its input side.
+        ret->SetOutputSymbols(get_fst()->OutputSymbols());
+    } else {
+        // Stupid library requires second FST to be unweighted.
+        ArcSortFst<Arc, ILabelCompare<Arc> > tmp(
+            MapFst<Arc, Arc, RmWeightMapper<Arc> >(
+                *f->get_fst(), RmWeightMapper<Arc>()),
+            ILabelCompare<Arc>());
+        fst::Difference(*get_fst(), tmp, ret);
+    }
+    FSTImpl * res = new FSTImpl<Arc>(ret);
+    memo.insert(key, res);
+    return res;
+}
+
+static double
+now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+template <class Arc>
+static void
+det_report(const BoundedDeterminizer<Arc>& det, double seconds, bool complete,
+           det_stats * stats)
+{
+    stats->states = det.NumStates();
+    stats->arcs = det.NumArcs();
+    stats->max_subset = det.MaxSubset();
+    stats->mean_subset = det.MeanSubset();
+    stats->collision_rate = det.CollisionRate();
+    stats->seconds = seconds;
+    stats->states_per_second = seconds > 0 ? det.NumStates() / seconds : 0;
+    stats->coverage = det.Coverage();
+    const vector<size_t>& lv = det.Levels();
+    stats->growth = lv.size() >= 2
+        ? (double)lv[lv.size() - 1] / lv[lv.size() - 2] : 1;
+    stats->predicted_states = det.NumStates();
+    stats->complete = complete;
+}
+
+/// Determinize FST into OUT within the budgets, reporting to STATS if
+/// given.  False if over budget, with the size reached in STATES and
+/// ARCS.  The subset table is gone by the time this returns, so the
+/// caller may croak.
+template <class Arc>
+static bool
+bounded_determinize(const fst::Fst<Arc>& fst, MutableFst<Arc> * out,
+                    float del, int max_states, int max_arcs,
+                    float threshold, det_stats * stats,
+                    size_t * states, size_t * arcs)
+{
+    EncodeMapper<Arc> enc(ENCODE_LABEL, ENCODE);
+    EncodeFst<Arc> encoded(fst, &enc);
+    vector<typename Arc::Weight> beta;
+    if (threshold >= 0)
+        ShortestDistance(fst, &beta, true);
+    BoundedDeterminizer<Arc> det(encoded, del,
+                                 max_states > 0 ? max_states : 0,
+                                 max_arcs > 0 ? max_arcs : 0,
+                                 threshold, &beta);
+    double t = now();
+    bool done = det.run(out);
+    if (stats)
+        det_report(det, now() - t, done, stats);
+    *states = det.NumStates();
+    *arcs = det.NumArcs();
+    if (!done)
+        return false;
+    fst::Decode(out, enc);
+    if (threshold >= 0)
+        Connect(out);
+    return true;
 }
 
 template <class Arc>
 FST *
-FSTImpl<Arc>::Determinize(float del) const
+FSTImpl<Arc>::Determinize(float del, int max_states, int max_arcs,
+                          float threshold, det_stats * stats) const
 {
+    if (threshold >= 0)
+        check_semiring("Determinize() with a threshold");
+    cache_key key = memo_key(CACHE_DETERMINIZE, this, (FSTImpl *)NULL, del);
+    key.b = hash_mix(hash_mix(max_states, max_arcs), float_bits(threshold));
+    if (!stats)
+        if (FST * hit = memo.find(key))
+            return hit;
     // NOTE: we encode/decode here to make the FST functional
     // (acceptors always are) and thereby avoid library bitching.
+    VectorFst<Arc> * ret;
+    if (max_states <= 0 && max_arcs <= 0 && threshold < 0 && !stats) {
+        // Every stage is lazy, so only the input, the output and the
+        // determinizer's subset table are ever fully in memory; cached
+        // states are collected as soon as they have been copied out.
+        try {
+            EncodeMapper<Arc> enc(ENCODE_LABEL, ENCODE);
+            EncodeFst<Arc> encoded(*fst, &enc);
+            DeterminizeFst<Arc> det(encoded,
+                                    DeterminizeFstOptions(CacheOptions(true, 0),
+                                                          del));
+            ret = new VectorFst<Arc>(DecodeFst<Arc>(det, enc));
+        } catch (fst_exception e) {
+            croak("%s", e.what());
+        }
+    } else {
+        // Bounded: build it ourselves, so we can stop when out of budget.
+        ret = new VectorFst<Arc>;
+        size_t states, arcs;
+        bool done;
+        try {
+            done = bounded_determinize(*fst, ret, del, max_states, max_arcs,
+                                       threshold, stats, &states, &arcs);
+        } catch (fst_exception e) {
+            delete ret;
+            croak("%s", e.what());
+        }
+        if (!done) {
+            delete ret;
+            croak("Determinize() stopped early: over budget at %lu states, "
+                  "%lu arcs", (unsigned long)states, (unsigned long)arcs);
+        }
+    }
+    ret->SetInputSymbols(fst->InputSymbols());
+    ret->SetOutputSymbols(fst->OutputSymbols());
+    FSTImpl * res = new FSTImpl<Arc>(ret);
+    if (!stats)
+        memo.insert(key, res);
+    return res;
+}
+
+template <class Arc>
+void
+FSTImpl<Arc>::determinize_estimate(float del, int sample,
+                                   det_stats& stats) const
+{
     EncodeMapper<Arc> enc(ENCODE_LABEL, ENCODE);
-    FSTImpl * tmp = new FSTImpl(fst->Copy());
-    Encode(tmp->fst, &enc);
-    VectorFst<Arc> * ret = new VectorFst<Arc>;
-    fst::Determinize(*tmp->fst, ret, DeterminizeOptions(del));
-    Decode(ret, enc);
-    return new FSTImpl<Arc>(ret);
+    EncodeFst<Arc> encoded(*fst, &enc);
+    BoundedDeterminizer<Arc> det(encoded, del, sample > 0 ? sample : 0, 0,
+                                 -1, NULL);
+    VectorFst<Arc> out;
+    double t = now();
+    bool done = det.run(&out);
+    det_report(det, now() - t, done, &stats);
+    if (done)
+        return;
+    // Each breadth-first level tends to reach new input states at a
+    // steady rate, and subset constructions that blow up do so by a
+    // steady factor per level.  Assume both hold until every input
+    // state has been reached.
+    const vector<size_t>& lv = det.Levels();
+    const vector<size_t>& cv = det.LevelCoverage();
+    size_t depth = lv.size();
+    double seen = 0;
+    for (size_t i = 0; i < depth; i++)
+        seen += lv[i];
+    double rate = (double)cv[depth - 1] / depth;
+    double left = max(fst->NumStates() - (double)cv[depth - 1], 0.0) / rate;
+    double g = stats.growth, last = lv[depth - 1];
+    double rest = g > 1.001 ? last * g * (pow(g, left) - 1) / (g - 1)
+        : last * left;
+    stats.predicted_states = max(seen + rest, (double)stats.states);
 }
 
 template <class Arc>
 FST *
 FSTImpl<Arc>::EpsNormalize(int type) const
 {
-    FSTImpl * ret = new FSTImpl(fst->Copy());
+    FSTImpl * ret = new FSTImpl(new VectorFst<Arc>);
     // XXX: type-1 so project and epsnormalize use the same constants
     try {
         fst::EpsNormalize(*fst, ret->fst, (EpsNormalizeType)(type-1));
@@ -327,34 +1123,51 @@ FSTImpl<Arc>::EpsNormalize(int type) const
     return ret;
 }
 
+/// Pick a minimizer.  The acyclic and parallel ones encode labels
+/// and weights themselves.  If ACCEPTOR, FST's labels have already
+/// been encoded.  GENERAL skips straight to fst::Minimize.
 template <class Arc>
-void
-FSTImpl<Arc>::_Minimize()
+static void
+minimize(MutableFst<Arc> * fst, int threads, bool acceptor = false,
+         bool general = false)
 {
-    // NOTE: we encode/decode here to make the FST functional
-    // (acceptors always are) and thereby avoid library bitching.
-    try {
+    uint32 flags = acceptor ? ENCODE_WEIGHT : ENCODE_LABEL | ENCODE_WEIGHT;
+    if (!general && fst->Properties(kAcyclic, true)) {
+        acyclic_minimize(fst, flags);
+    } else if (!general && threads > 1) {
+        parallel_minimize(fst, threads, flags);
+    } else if (acceptor) {
+        fst::Minimize(fst);
+    } else {
+        // NOTE: we encode/decode here to make the FST functional
+        // (acceptors always are) and thereby avoid library bitching.
         EncodeMapper<Arc> enc(ENCODE_LABEL, ENCODE);
         Encode(fst, &enc);
         fst::Minimize(fst);
         Decode(fst, enc);
+    }
+}
+
+template <class Arc>
+void
+FSTImpl<Arc>::_Minimize(int threads, bool general)
+{
+    try {
+        minimize(fst, threads, false, general);
     } catch (fst_exception e) {
+        touched();
         croak("%s", e.what());
     }
+    touched();
 }
 
 template <class Arc>
 FST *
-FSTImpl<Arc>::Minimize() const
+FSTImpl<Arc>::Minimize(int threads) const
 {
-    // NOTE: we encode/decode here to make the FST functional
-    // (acceptors always are) and thereby avoid library bitching.
-    EncodeMapper<Arc> enc(ENCODE_LABEL, ENCODE);
-    FSTImpl * tmp = new FSTImpl(fst->Copy());
+    FSTImpl * tmp = new FSTImpl(*this);
     try {
-        Encode(tmp->fst, &enc);
-        fst::Minimize(tmp->fst);
-        Decode(tmp->fst, enc);
+        minimize(tmp->fst, threads);
         return tmp;
     } catch (fst_exception e) {
         delete tmp;
@@ -362,12 +1175,69 @@ FSTImpl<Arc>::Minimize() const
     }
 }
 
+template <class Arc>
+static void
+stage_done(vector<stage_stats>& stats, const char * stage, double& start,
+           const MutableFst<Arc>& f)
+{
+    stage_stats st;
+    st.stage = stage;
+    st.seconds = now() - start;
+    st.states = f.NumStates();
+    st.arcs = 0;
+    for (int s = 0; s < st.states; s++)
+        st.arcs += f.NumArcs(s);
+    stats.push_back(st);
+    start = now();
+}
+
+template <class Arc>
+FST *
+FSTImpl<Arc>::optimize(float delta, int threads, int sort,
+                       vector<stage_stats>& stats) const
+{
+    MutableFst<Arc> * work = counted_copy(*fst);
+    double t = now();
+    try {
+        rm_epsilon(work, delta, threads);
+        stage_done(stats, "rmepsilon", t, *work);
+        // Epsilons must be gone first: encoding would hide them.  From
+        // here on, everything works on the one encoded acceptor.
+        EncodeMapper<Arc> enc(ENCODE_LABEL, ENCODE);
+        Encode(work, &enc);
+        {
+            DeterminizeFst<Arc> det(*work,
+                                    DeterminizeFstOptions(CacheOptions(true, 0),
+                                                          delta));
+            MutableFst<Arc> * next = new VectorFst<Arc>(det);
+            delete work;
+            work = next;
+        }
+        stage_done(stats, "determinize", t, *work);
+        minimize(work, threads, true);
+        stage_done(stats, "minimize", t, *work);
+        Decode(work, enc);
+        if (sort == OUTPUT)
+            ArcSort(work, OLabelCompare<Arc>());
+        else
+            ArcSort(work, ILabelCompare<Arc>());
+        stage_done(stats, "arcsort", t, *work);
+    } catch (fst_exception e) {
+        delete work;
+        croak("%s", e.what());
+    }
+    work->SetInputSymbols(fst->InputSymbols());
+    work->SetOutputSymbols(fst->OutputSymbols());
+    return new FSTImpl<Arc>(work);
+}
+
 template <class Arc>
 void
 FSTImpl<Arc>::_Encode(int flags)
 {
     EncodeMapper<Arc> tmp(flags, ENCODE);
     Encode(fst, &tmp);
+    touched();
 }
 
 template <class Arc>
@@ -376,13 +1246,16 @@ FSTImpl<Arc>::_Decode(int flags)
 {
     EncodeMapper<Arc> tmp(flags, DECODE);
     Decode(fst, tmp);
+    touched();
 }
 
 template <class Arc>
 FST *
-FSTImpl<Arc>::Reverse() const
+FSTImpl<Arc>::Reverse(bool lazy) const
 {
-    FSTImpl * ret = new FSTImpl(fst->Copy());
+    if (lazy)
+        return new FSTImpl(new LazyMutableFst<Arc>(new ReverseView<Arc>(*fst)));
+    FSTImpl * ret = new FSTImpl(new VectorFst<Arc>);
     fst::Reverse(*fst, ret->fst);
     return ret;
 }
@@ -390,10 +1263,13 @@ FSTImpl<Arc>::Reverse() const
 //////////////////////////////////////////////////////////////////////
 // Extension functions/methods:
 
-// template <>
-// int
-// FSTImpl<RealArc>::semiring() const
-// { return SMRReal; }
+// OpenFST only registers its own arc types for reading.
+REGISTER_FST(VectorFst, RealArc);
+
+template <>
+int
+FSTImpl<RealArc>::semiring() const
+{ return SMRReal; }
 
 template <>
 int
@@ -427,24 +1303,32 @@ FSTImpl<Arc>::copy_to(FST * to) const
     }
 }
 
-// template <>
-// FST *
-// FSTImpl<RealArc>::change_semiring(int smr) const
-// {
-//     if (smr == SMRReal)
-//         return Copy();
-//     FST * ret;
-//     if (smr == SMRLog) {
-//         ret = new FSTImpl<LogArc>(new VectorFst<LogArc>);
-//     } else if (smr == SMRTropical) {
-//         ret = new FSTImpl<StdArc>(new VectorFst<StdArc>);
-//     } else {
-//         cerr << "Unknown semiring " << smr << endl;
-//         return NULL;
-//     }
-//     copy_to(ret);
-//     return ret;
-// }
+/// FST mapped by MAPPER into semiring B.  Weights are converted
+/// between costs and probabilities, unlike copy_to().
+template <class B, class A, class M>
+FST *
+mapped_copy(const fst::Fst<A>& fst, const M& mapper)
+{
+    FSTImpl<B> * ret = new FSTImpl<B>(new VectorFst<B>);
+    Map(fst, ret->fst, mapper);
+    ret->fst->SetInputSymbols(fst.InputSymbols());
+    ret->fst->SetOutputSymbols(fst.OutputSymbols());
+    return ret;
+}
+
+template <>
+FST *
+FSTImpl<RealArc>::change_semiring(int smr) const
+{
+    if (smr == SMRReal)
+        return Copy();
+    if (smr == SMRLog)
+        return mapped_copy<LogArc>(*fst, from_real_mapper<LogArc>());
+    if (smr == SMRTropical)
+        return mapped_copy<StdArc>(*fst, from_real_mapper<StdArc>());
+    cerr << "Unknown semiring " << smr << endl;
+    return NULL;
+}
 
 template <>
 FST *
@@ -452,6 +1336,8 @@ FSTImpl<StdArc>::change_semiring(int smr) const
 {
     if (smr == SMRTropical)
         return Copy();
+    if (smr == SMRReal)
+        return mapped_copy<RealArc>(*fst, to_real_mapper<StdArc>());
     FSTImpl<LogArc> * ret;
     if (smr == SMRLog) {
         ret = new FSTImpl<LogArc>(new VectorFst<LogArc>);
@@ -471,6 +1357,8 @@ FSTImpl<LogArc>::change_semiring(int smr) const
 {
     if (smr == SMRLog)
         return Copy();
+    if (smr == SMRReal)
+        return mapped_copy<RealArc>(*fst, to_real_mapper<LogArc>());
     FSTImpl<StdArc> * ret;
     if (smr == SMRTropical) {
         ret = new FSTImpl<StdArc>(new VectorFst<StdArc>);
@@ -484,6 +1372,35 @@ FSTImpl<LogArc>::change_semiring(int smr) const
     return ret;
 }
 
+template <class Arc>
+uint64
+FSTImpl<Arc>::fingerprint() const
+{
+    if (have_print)
+        return print;
+    uint64 h = hash_mix(semiring(), fst->Start());
+    for (fst::StateIterator<fst::Fst<Arc> > it(*fst); !it.Done(); it.Next()) {
+        // Arcs are summed so that sorting them leaves the print alone.
+        uint64 arcs = 0;
+        for (ArcIterator<fst::Fst<Arc> > ai(*fst, it.Value());
+             !ai.Done(); ai.Next()) {
+            const Arc& a = ai.Value();
+            arcs += hash_mix(hash_mix(hash_mix(a.ilabel, a.olabel),
+                                      float_bits(a.weight.Value())),
+                             a.nextstate);
+        }
+        h = hash_mix(hash_mix(h, float_bits(fst->Final(it.Value()).Value())),
+                     arcs);
+    }
+    if (fst->InputSymbols())
+        h = hash_mix(h, symtab_fingerprint(fst->InputSymbols()));
+    if (fst->OutputSymbols())
+        h = hash_mix(h, symtab_fingerprint(fst->OutputSymbols()));
+    print = h;
+    have_print = true;
+    return h;
+}
+
 template <class Arc>
 void
 FSTImpl<Arc>::add_arc(int from, int to, float w,
@@ -495,34 +1412,13 @@ FSTImpl<Arc>::add_arc(int from, int to, float w,
     AddArc(from, to, w, iin, iout);
 }
 
-template <class Arc>
-void
-FSTImpl<Arc>::strings(vector<string>& out) const
-{
-    _strings(out, fst->Start(), "");
-}
-
-template <class Arc>
-void
-FSTImpl<Arc>::_strings(vector<string>& out, int st, const string& cur) const
-{
-    if (fst->Final(st) != Arc::Weight::Zero()) {
-        out.push_back(cur);
-    } else {
-        for (ArcIterator<fst::Fst<Arc> > ai(*fst, st); !ai.Done(); ai.Next()) {
-            ostringstream il;
-            il << cur << ai.Value().ilabel;
-            _strings(out, ai.Value().nextstate, il.str());
-        }
-    }
-}
-
 template <class Arc>
 void
 FSTImpl<Arc>::normalize()
 {
     typedef typename Arc::Weight Weight;
-    Push(fst, (fst::ReweightType)INITIAL);
+    check_semiring("normalize()", true);
+    _Push(INITIAL, 1);
     Weight w = Weight::Zero();
     int st = fst->Start();
     if (st < 0) {
@@ -564,11 +1460,216 @@ VectorFST(int smr)
         return new FSTImpl<LogArc>(new VectorFst<LogArc>);
     case SMRTropical:
         return new FSTImpl<StdArc>(new VectorFst<StdArc>);
+    case SMRReal:
+        return new FSTImpl<RealArc>(new VectorFst<RealArc>);
     default:
         return NULL;
     };
 }
 
+//////////////////////////////////////////////////////////////////////
+// Lexicon builder
+
+LexiconBuilder::LexiconBuilder(int _smr)
+    : smr(_smr), syms(NULL)
+{
+    reset();
+}
+
+LexiconBuilder::~LexiconBuilder()
+{
+    delete syms;
+}
+
+void
+LexiconBuilder::reset()
+{
+    delete syms;
+    syms = new SymbolTable("");
+    // remember to add epsilon!
+    syms->AddSymbol("-");
+    vector<state>(1).swap(states);
+    unused.clear();
+    path.assign(1, 0);
+    labels.clear();
+    heads.assign(1024, -1);
+    chain.clear();
+    hashes.clear();
+    nregistered = 0;
+}
+
+int
+LexiconBuilder::new_state()
+{
+    if (!unused.empty()) {
+        int s = unused.back();
+        unused.pop_back();
+        return s;
+    }
+    states.push_back(state());
+    return states.size() - 1;
+}
+
+size_t
+LexiconBuilder::hash(int s) const
+{
+    const state& st = states[s];
+    uint64 h = st.final;
+    for (size_t i = 0; i < st.arcs.size(); i++)
+        h = hash_mix(hash_mix(h, st.arcs[i].first), st.arcs[i].second);
+    return h;
+}
+
+bool
+LexiconBuilder::same(int a, int b) const
+{
+    return states[a].final == states[b].final
+        && states[a].arcs == states[b].arcs;
+}
+
+/// The registered state equivalent to S, or S after registering it.
+int
+LexiconBuilder::find_or_register(int s)
+{
+    size_t h = hash(s);
+    for (int r = heads[h & (heads.size() - 1)]; r >= 0; r = chain[r])
+        if (hashes[r] == h && same(r, s))
+            return r;
+    if (chain.size() < states.size()) {
+        chain.resize(states.size(), -1);
+        hashes.resize(states.size());
+    }
+    hashes[s] = h;
+    states[s].registered = true;
+    if (++nregistered > heads.size()) {
+        heads.assign(heads.size() * 2, -1);
+        for (size_t i = 0; i < states.size(); i++) {
+            if (states[i].registered && i != (size_t)s) {
+                size_t b = hashes[i] & (heads.size() - 1);
+                chain[i] = heads[b];
+                heads[b] = i;
+            }
+        }
+    }
+    size_t b = h & (heads.size() - 1);
+    chain[s] = heads[b];
+    heads[b] = s;
+    return s;
+}
+
+/// Freeze the last word's path below DEPTH, deepest state first.
+void
+LexiconBuilder::freeze(size_t depth)
+{
+    for (size_t i = path.size() - 1; i > depth; i--) {
+        int s = path[i];
+        int r = find_or_register(s);
+        if (r != s) {
+            states[path[i - 1]].arcs.back().second = r;
+            states[s] = state();
+            unused.push_back(s);
+        }
+    }
+    path.resize(depth + 1);
+    labels.resize(depth);
+}
+
+bool
+LexiconBuilder::add(const vector<string>& word)
+{
+    size_t n = word.size(), p = 0;
+    // Common prefix with the last word.
+    while (p < n && p < labels.size() && syms->Find(word[p]) == labels[p])
+        p++;
+    // The last word's path ends in a final state, except for the bare
+    // start state of an empty builder, where an empty word is new.
+    if (p == n && n == labels.size() && states[path.back()].final)
+        return true;            // repeated word
+    if (p < n) {
+        // The new arc must not duplicate one that is about to be, or
+        // already is, frozen.
+        int l = syms->Find(word[p]);
+        const vector<arc>& arcs = states[path[p]].arcs;
+        for (size_t i = 0; i < arcs.size(); i++)
+            if (arcs[i].first == l)
+                return false;
+    }
+    freeze(p);
+    for (size_t i = p; i < n; i++) {
+        int l = syms->AddSymbol(word[i]);
+        int s = new_state();
+        states[path.back()].arcs.push_back(arc(l, s));
+        path.push_back(s);
+        labels.push_back(l);
+    }
+    states[path.back()].final = true;
+    return true;
+}
+
+template <class Arc>
+static FST *
+lexicon_fst(const vector<pair<int, int> > * arcs, const vector<bool>& final,
+            const vector<int>& id, const vector<int>& order,
+            SymbolTable * syms)
+{
+    VectorFst<Arc> * ret = new VectorFst<Arc>;
+    for (size_t i = 0; i < order.size(); i++)
+        ret->AddState();
+    ret->SetStart(0);
+    for (size_t i = 0; i < order.size(); i++) {
+        int s = order[i];
+        if (final[s])
+            ret->SetFinal(i, Arc::Weight::One());
+        for (size_t j = 0; j < arcs[s].size(); j++) {
+            int l = arcs[s][j].first;
+            ret->AddArc(i, Arc(l, l, Arc::Weight::One(), id[arcs[s][j].second]));
+        }
+    }
+    ret->SetInputSymbols(syms);
+    ret->SetOutputSymbols(syms);
+    return new FSTImpl<Arc>(ret);
+}
+
+FST *
+LexiconBuilder::finish()
+{
+    freeze(0);
+    // Number the live states breadth-first from the start.
+    vector<int> id(states.size(), -1), order(1, 0);
+    id[0] = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        const vector<arc>& arcs = states[order[i]].arcs;
+        for (size_t j = 0; j < arcs.size(); j++) {
+            if (id[arcs[j].second] < 0) {
+                id[arcs[j].second] = order.size();
+                order.push_back(arcs[j].second);
+            }
+        }
+    }
+    vector<vector<arc> > arcs(states.size());
+    vector<bool> final(states.size());
+    for (size_t i = 0; i < states.size(); i++) {
+        arcs[i].swap(states[i].arcs);
+        final[i] = states[i].final;
+    }
+    vector<state>().swap(states);
+    FST * ret;
+    switch (smr) {
+    case SMRTropical:
+        ret = lexicon_fst<StdArc>(&arcs[0], final, id, order, syms);
+        break;
+    case SMRReal:
+        ret = lexicon_fst<RealArc>(&arcs[0], final, id, order, syms);
+        break;
+    case SMRLog:
+    default:
+        ret = lexicon_fst<LogArc>(&arcs[0], final, id, order, syms);
+        break;
+    }
+    reset();
+    return ret;
+}
+
 //////////////////////////////////////////////////////////////////////
 // I/O
 
@@ -608,6 +1709,14 @@ ReadText(const char * file, int smr, bool acceptor,
         return f ? new FSTImpl<fst::StdArc>(f) : NULL;
         break;
     }
+
+    case SMRReal: {
+        FstReader<RealArc> r;
+        MutableFst<RealArc> * f
+            = r.read(in, file, is, os, ss, acceptor, true, true, false);
+        return f ? new FSTImpl<RealArc>(f) : NULL;
+        break;
+    }
     default:
         cerr << "aiee: don't recognize semiring " << smr << endl;
         return NULL;
@@ -668,6 +1777,10 @@ ReadBinary(const char * file, int smr)
         return new FSTImpl<fst::StdArc>(file);
         break;
 
+    case SMRReal:
+        return new FSTImpl<RealArc>(file);
+        break;
+
     default:
         return NULL;
     };
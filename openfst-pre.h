@@ -23,6 +23,7 @@ public:
 #include "fst/lib/closure.h"
 #include "fst/lib/compose.h"
 #include "fst/lib/concat.h"
+#include "fst/lib/connect.h"
 #include "fst/lib/determinize.h"
 #include "fst/lib/difference.h"
 #include "fst/lib/encode.h"
@@ -38,6 +39,7 @@ public:
 #include "fst/lib/push.h"
 #include "fst/lib/reverse.h"
 #include "fst/lib/rmepsilon.h"
+#include "fst/lib/shortest-distance.h"
 #include "fst/lib/shortest-path.h"
 #include "fst/lib/symbol-table.h"
 #include "fst/lib/union.h"
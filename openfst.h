@@ -42,6 +42,66 @@ namespace fst {
 
 using fst::SymbolTable;
 
+/// Report on one stage of FST::optimize(): its wall-clock time and
+/// the size of its result.
+struct stage_stats
+{
+    const char * stage;
+    double seconds;
+    int states;
+    long arcs;
+};
+
+/// Subset table statistics from FST::Determinize() and
+/// FST::determinize_estimate().
+struct det_stats
+{
+    int states;
+    long arcs;
+    int max_subset;             // largest subset of input states
+    double mean_subset;
+    double collision_rate;      // failed probes per subset lookup
+    double seconds;
+    double states_per_second;
+    int coverage;               // input states seen in some subset
+    double growth;              // last breadth-first level / the one before
+    double predicted_states;    // estimated size of the full result
+    bool complete;              // whether STATES is the full result
+};
+
+/// Search statistics from FST::beam_search().
+struct decode_stats
+{
+    long created;               // tokens created
+    long pruned;                // tokens dropped by the beam or MAX_ACTIVE
+    long expanded;              // tokens whose arcs were followed
+    long pool;                  // token slots allocated
+};
+
+/// An FST's paths one at a time, best first; see FST::paths().
+struct PathIterator
+{
+    virtual ~PathIterator() { }
+    /// The next path's non-epsilon labels and cost.  False when there
+    /// are no more paths.
+    virtual bool next(vector<int>& in, vector<int>& out, float& cost) = 0;
+    virtual SymbolTable * InputSymbols() const = 0;
+    virtual SymbolTable * OutputSymbols() const = 0;
+};
+
+/// An FST's label strings one at a time; see FST::string_iterator().
+struct StringIterator
+{
+    virtual ~StringIterator() { }
+    /// The next string's non-epsilon labels.  False when there are no
+    /// more, or a limit was reached.
+    virtual bool next(vector<int>& labels) = 0;
+    /// Whether a limit or a cycle cut the enumeration short.
+    virtual bool truncated() const = 0;
+    /// The table for the labels' side.
+    virtual SymbolTable * Symbols() const = 0;
+};
+
 /// Base class for Perl FSTs
 struct FST
 {
@@ -58,6 +118,10 @@ struct FST
     virtual FST * Compose(FST * ) const = 0;
     virtual FST * Intersect(FST * ) const = 0;
     virtual FST * Difference(FST * ) const = 0;
+    /// Compose each FST in IN with this one on up to THREADS threads,
+    /// keeping only the NBEST best paths of each result if NBEST > 0.
+    virtual void compose_batch(const vector<FST *>& in, int threads,
+                               unsigned nbest, vector<FST *>& out) const = 0;
     // Destructive versions:
     virtual void _Union(const FST * ) = 0;
     virtual void _Concat(const FST * ) = 0;
@@ -67,18 +131,46 @@ struct FST
     virtual void _Project(int ) = 0;
     virtual void _Encode(int ) = 0;
     virtual void _Decode(int ) = 0;
-    virtual FST * Reverse() const = 0;
+    /// LAZY builds the reversed arcs on first use, and a full copy
+    /// only if the result is modified.
+    virtual FST * Reverse(bool lazy = false) const = 0;
     virtual void _Invert() = 0;
+    virtual void _ArcSort(int ) = 0;
+    virtual void _RmWeight() = 0;
 
     // Cleanup
     // XXX: why only some destructive?
-    virtual FST * Determinize(float) const = 0;
-    virtual void _Prune(float) = 0;
-    virtual void _RmEpsilon(float) = 0;
+    /// Stop and croak after MAX_STATES states or MAX_ARCS arcs (0 for
+    /// no limit); with THRESHOLD >= 0, drop states off paths worse than
+    /// THRESHOLD from the best one.  With STATS, fill it in (bypassing
+    /// the cache).
+    virtual FST * Determinize(float, int max_states = 0, int max_arcs = 0,
+                              float threshold = -1,
+                              det_stats * stats = NULL) const = 0;
+    /// Determinize at most SAMPLE states and extrapolate the full
+    /// result's size from the share of input states they cover.
+    virtual void determinize_estimate(float delta, int sample,
+                                      det_stats& stats) const = 0;
+    /// THREADS > 1 computes the distances Prune, Push and ShortestPath
+    /// need in parallel, if they are not cached already.
+    virtual void _Prune(float, int threads = 1) = 0;
+    /// THREADS > 1 removes epsilons component by component in parallel.
+    virtual void _RmEpsilon(float, int threads = 1) = 0;
     virtual FST * EpsNormalize(int ) const = 0;
-    virtual void _Minimize() = 0;
-    virtual FST * Minimize() const = 0;
-    virtual void _Push(int) = 0;
+    /// THREADS > 1 minimizes by parallel partition refinement.
+    /// GENERAL always uses fst::Minimize, e.g. for benchmarks.
+    virtual void _Minimize(int threads = 1, bool general = false) = 0;
+    virtual FST * Minimize(int threads = 1) const = 0;
+    virtual void _Push(int, int threads = 1) = 0;
+    /// Each state's shortest distance from the start, or if REVERSE,
+    /// to the final states.  Cached until the FST changes, and shared
+    /// with Push, Prune, normalize and ShortestPath.
+    virtual void distances(bool reverse, vector<float>& out,
+                           int threads = 1) const = 0;
+    /// RmEpsilon, Determinize, Minimize and ArcSort(SORT) under one
+    /// label encoding, appending a report per stage to STATS.
+    virtual FST * optimize(float delta, int threads, int sort,
+                           vector<stage_stats>& stats) const = 0;
 
     // Construction
     virtual void AddState() = 0;
@@ -96,7 +188,11 @@ struct FST
     virtual void WriteText(const char *) const = 0;
     virtual string _String() const = 0;
     virtual string _Draw() const = 0;
-    virtual void strings(vector<string>& ) const = 0;
+    /// Enumerate the label strings of OUTPUT or input labels, as
+    /// StringEnumerator describes.
+    virtual StringIterator * string_iterator(bool output, size_t max_count,
+                                             size_t max_length,
+                                             bool cycles) const = 0;
     SV* String() const;
     SV* Draw() const;
     virtual int NumStates() const = 0;
@@ -104,7 +200,32 @@ struct FST
     virtual unsigned Properties(bool ) const = 0;
 
     // "Other" algorithms
-    virtual FST * ShortestPath(unsigned , int ) const = 0;
+    /// With ASTAR, search guided by each state's best cost to a final
+    /// state, computed on first use and kept until the FST changes;
+    /// UNIQUE then means unique output strings.
+    virtual FST * ShortestPath(unsigned , int , bool astar = false,
+                               int threads = 1) const = 0;
+    /// The N cheapest distinct outputs for input labels IN, with their
+    /// costs, by Viterbi search directly against the FST.
+    virtual void transduce(const vector<int>& in, unsigned n,
+                           vector<pair<vector<int>, float> >& out) const = 0;
+    /// Each arc's posterior probability, by state and then arc, for
+    /// an acyclic log-semiring FST.
+    virtual void posteriors(vector<float>& out) const = 0;
+    /// The best output for IN by Viterbi beam search, keeping tokens
+    /// within BEAM of the best and at most MAX_ACTIVE states per input
+    /// symbol (BEAM < 0 and MAX_ACTIVE of 0 mean no limit).  False if
+    /// no path survived.
+    virtual bool beam_search(const vector<int>& in, float beam,
+                             unsigned max_active, vector<int>& out,
+                             float& cost, decode_stats * stats) const = 0;
+    /// transduce() each of IN on up to THREADS threads, sharing the
+    /// FST read-only.
+    virtual void transduce_batch(
+        const vector<vector<int> >& in, unsigned n, int threads,
+        vector<vector<pair<vector<int>, float> > >& out) const = 0;
+    /// Enumerate paths lazily, skipping repeated outputs if UNIQUE.
+    virtual PathIterator * paths(bool unique) const = 0;
     virtual void normalize() = 0;
     virtual FST * markovize(int ) const = 0;
 };
@@ -148,4 +269,18 @@ Transducer(const char * f, int smr,
 FST *
 VectorFST(int );
 
+/// Memoize Compose, Intersect, Difference and Determinize, keeping at
+/// most N results.  0, the default, turns the cache off.
+void
+cache_size(int );
+
+/// Number of FST copies made so far, including those that operations
+/// make to leave their input unchanged.
+unsigned long
+copy_count();
+
+void
+cache_stats(unsigned long& hits, unsigned long& misses,
+            unsigned long& entries, unsigned long& size);
+
 #endif // _OPENFST_H
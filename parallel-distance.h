@@ -0,0 +1,334 @@
+#ifndef _parallel_distance_h
+#define _parallel_distance_h
+
+// Multi-threaded single-source shortest distance.  The FST is read
+// once into flat arrays, oriented so that distances flow along them
+// (backwards for distances to the final states).  Acyclic FSTs are
+// split into levels, each state one past its deepest predecessor, and
+// each level's states pull their distances from the levels before it
+// in parallel, in any semiring.  Cyclic FSTs with tropical costs use
+// delta-stepping: states are bucketed by distance in steps of DELTA,
+// and each bucket's arcs are relaxed in parallel, workers queueing
+// their improvements to be applied between rounds.  Tentative
+// distances never run more than the largest arc cost (or the spread
+// of the initial costs) past the bucket being processed, so the
+// buckets form a ring of that span rather than an array over all
+// distances.
+
+#include <algorithm>
+#include <vector>
+#include "threads.h"
+using namespace std;
+using namespace fst;
+
+template <class Arc>
+class ParallelDistance
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Weight Weight;
+
+    ParallelDistance(const ExpandedFst<Arc>& fst, bool reverse);
+
+    /// Distances in any semiring, for acyclic FSTs.
+    void levels(vector<Weight> * d, int threads);
+    /// Distances by tropical cost.  False if there are negative costs.
+    bool delta_stepping(vector<Weight> * d, int threads);
+
+private:
+    struct edge
+    {
+        StateId src;
+        float cost;
+        Weight weight;
+        edge(StateId s, const Weight& w)
+            : src(s), cost(w.Value()), weight(w) { }
+    };
+    typedef pair<StateId, float> request;
+
+    struct level_job
+    {
+        ParallelDistance * p;
+        vector<Weight> * d;
+        size_t lo;
+        void operator()(int i, int)
+            {
+                StateId v = p->order[lo + i];
+                Weight x = p->init[v];
+                for (size_t j = p->off[v]; j < p->off[v + 1]; j++) {
+                    const edge& e = p->in[j];
+                    x = Plus(x, p->reverse
+                             ? Times(e.weight, (*d)[e.src])
+                             : Times((*d)[e.src], e.weight));
+                }
+                (*d)[v] = x;
+            }
+    };
+
+    struct relax_job
+    {
+        ParallelDistance * p;
+        const vector<StateId> * frontier;
+        bool heavy;
+        void operator()(int i, int worker)
+            {
+                StateId u = (*frontier)[i];
+                float du = p->cost[u];
+                vector<request>& out = p->requests[worker];
+                for (size_t j = p->ooff[u]; j < p->ooff[u + 1]; j++) {
+                    const pair<StateId, float>& e = p->out[j];
+                    if ((e.second > p->delta) == heavy)
+                        out.push_back(request(e.first, du + e.second));
+                }
+            }
+    };
+
+    bool reverse;
+    StateId n;
+    vector<Weight> init;            // One at the source(s), else Zero
+    // Edges into each state, in the direction distances flow.
+    vector<size_t> off;
+    vector<edge> in;
+
+    // Level-synchronous
+    vector<StateId> order;          // states by level
+
+    // Edges out of each state, with their costs.
+    vector<size_t> ooff;
+    vector<pair<StateId, float> > out;
+    // Delta-stepping
+    vector<float> cost;
+    float delta;
+    vector<vector<StateId> > buckets;   // bucket b is buckets[b % size]
+    size_t pending;                     // entries in all buckets
+    vector<vector<request> > requests;
+
+    void outgoing();
+    void relax(StateId v, float x);
+    void apply();
+};
+
+template <class Arc>
+ParallelDistance<Arc>::ParallelDistance(const ExpandedFst<Arc>& fst,
+                                        bool rev)
+    : reverse(rev), n(fst.NumStates())
+{
+    init.assign(n, Weight::Zero());
+    off.assign(n + 1, 0);
+    if (!reverse) {
+        if (fst.Start() != kNoStateId)
+            init[fst.Start()] = Weight::One();
+    } else {
+        for (StateId s = 0; s < n; s++)
+            init[s] = fst.Final(s);
+    }
+    // Count, then fill, each state's incoming edges.
+    for (StateId s = 0; s < n; s++)
+        for (ArcIterator<ExpandedFst<Arc> > ai(fst, s); !ai.Done(); ai.Next())
+            off[(reverse ? s : ai.Value().nextstate) + 1]++;
+    for (StateId s = 0; s < n; s++)
+        off[s + 1] += off[s];
+    in.resize(off[n], edge(0, Weight::Zero()));
+    vector<size_t> pos(off.begin(), off.end() - 1);
+    for (StateId s = 0; s < n; s++)
+        for (ArcIterator<ExpandedFst<Arc> > ai(fst, s); !ai.Done(); ai.Next()) {
+            const Arc& a = ai.Value();
+            if (reverse)
+                in[pos[s]++] = edge(a.nextstate, a.weight);
+            else
+                in[pos[a.nextstate]++] = edge(s, a.weight);
+        }
+}
+
+template <class Arc>
+void
+ParallelDistance<Arc>::outgoing()
+{
+    ooff.assign(n + 1, 0);
+    for (size_t j = 0; j < in.size(); j++)
+        ooff[in[j].src + 1]++;
+    for (StateId s = 0; s < n; s++)
+        ooff[s + 1] += ooff[s];
+    out.resize(in.size());
+    vector<size_t> pos(ooff.begin(), ooff.end() - 1);
+    for (StateId v = 0; v < n; v++)
+        for (size_t j = off[v]; j < off[v + 1]; j++)
+            out[pos[in[j].src]++] = make_pair(v, in[j].cost);
+}
+
+template <class Arc>
+void
+ParallelDistance<Arc>::levels(vector<Weight> * d, int threads)
+{
+    // Kahn's algorithm, tracking each state's longest path in.
+    outgoing();
+    vector<size_t> indeg(n), level(n, 0);
+    for (StateId v = 0; v < n; v++)
+        indeg[v] = off[v + 1] - off[v];
+    vector<StateId> queue;
+    for (StateId v = 0; v < n; v++)
+        if (!indeg[v])
+            queue.push_back(v);
+    for (size_t i = 0; i < queue.size(); i++) {
+        StateId u = queue[i];
+        for (size_t j = ooff[u]; j < ooff[u + 1]; j++) {
+            StateId v = out[j].first;
+            if (level[v] < level[u] + 1)
+                level[v] = level[u] + 1;
+            if (!--indeg[v])
+                queue.push_back(v);
+        }
+    }
+
+    // Bucket states by level.
+    size_t nlevels = 0;
+    for (StateId v = 0; v < n; v++)
+        if (level[v] + 1 > nlevels)
+            nlevels = level[v] + 1;
+    vector<size_t> loff(nlevels + 1, 0);
+    for (StateId v = 0; v < n; v++)
+        loff[level[v] + 1]++;
+    for (size_t l = 0; l < nlevels; l++)
+        loff[l + 1] += loff[l];
+    order.resize(n);
+    {
+        vector<size_t> p(loff.begin(), loff.end() - 1);
+        for (StateId v = 0; v < n; v++)
+            order[p[level[v]]++] = v;
+    }
+
+    d->assign(n, Weight::Zero());
+    for (size_t l = 0; l < nlevels; l++) {
+        level_job j = { this, d, loff[l] };
+        parallel_for(loff[l + 1] - loff[l], threads, j, 256);
+    }
+}
+
+template <class Arc>
+void
+ParallelDistance<Arc>::relax(StateId v, float x)
+{
+    if (!(x < cost[v]))
+        return;
+    cost[v] = x;
+    buckets[(size_t)(x / delta) % buckets.size()].push_back(v);
+    pending++;
+}
+
+/// Apply the workers' requests, sequentially.
+template <class Arc>
+void
+ParallelDistance<Arc>::apply()
+{
+    for (size_t w = 0; w < requests.size(); w++) {
+        for (size_t i = 0; i < requests[w].size(); i++)
+            relax(requests[w][i].first, requests[w][i].second);
+        requests[w].clear();
+    }
+}
+
+template <class Arc>
+bool
+ParallelDistance<Arc>::delta_stepping(vector<Weight> * d, int threads)
+{
+    if (threads < 1)
+        threads = 1;
+    float inf = Weight::Zero().Value();
+    double total = 0;
+    size_t finite = 0;
+    float max_arc = 0;
+    for (size_t j = 0; j < in.size(); j++) {
+        if (in[j].cost < 0)
+            return false;
+        if (in[j].cost < inf) {
+            total += in[j].cost;
+            finite++;
+            max_arc = max(max_arc, in[j].cost);
+        }
+    }
+    float lo = inf, hi = 0;
+    for (StateId v = 0; v < n; v++) {
+        float c = init[v].Value();
+        if (c < 0)
+            return false;
+        if (c < inf) {
+            lo = min(lo, c);
+            hi = max(hi, c);
+        }
+    }
+    outgoing();
+    // The mean arc cost balances rounds per bucket against buckets;
+    // a floor of 1/1024 of the span keeps the ring small.
+    float span = max_arc + (lo < inf ? hi - lo : 0);
+    delta = total > 0 ? total / finite : 1;
+    if (delta < span / 1024)
+        delta = span / 1024;
+    buckets.assign((size_t)(span / delta) + 3, vector<StateId>());
+    pending = 0;
+
+    cost.assign(n, inf);
+    requests.assign(threads, vector<request>());
+    for (StateId v = 0; v < n; v++)
+        if (init[v].Value() < inf)
+            relax(v, init[v].Value());
+
+    vector<StateId> frontier, settled;
+    vector<bool> in_settled(n, false);
+    for (size_t b = lo < inf ? (size_t)(lo / delta) : 0; pending; b++) {
+        vector<StateId>& bucket = buckets[b % buckets.size()];
+        settled.clear();
+        while (!bucket.empty()) {
+            // Drop stale entries, of states that have since moved down.
+            frontier.clear();
+            for (size_t i = 0; i < bucket.size(); i++) {
+                StateId v = bucket[i];
+                if ((size_t)(cost[v] / delta) == b) {
+                    frontier.push_back(v);
+                    if (!in_settled[v]) {
+                        in_settled[v] = true;
+                        settled.push_back(v);
+                    }
+                }
+            }
+            pending -= bucket.size();
+            bucket.clear();
+            relax_job j = { this, &frontier, false };
+            parallel_for(frontier.size(), threads, j, 256);
+            apply();
+        }
+        relax_job j = { this, &settled, true };
+        parallel_for(settled.size(), threads, j, 256);
+        apply();
+        for (size_t i = 0; i < settled.size(); i++)
+            in_settled[settled[i]] = false;
+    }
+
+    d->resize(n);
+    for (StateId v = 0; v < n; v++)
+        (*d)[v] = Weight(cost[v]);
+    return true;
+}
+
+/// Shortest distances of FST from the start state, or if REVERSE, to
+/// the final states, on up to THREADS threads.  Cyclic FSTs must be
+/// TROPICAL, with no negative costs; otherwise, and with one thread,
+/// this is just fst::ShortestDistance.
+template <class Arc>
+void
+parallel_distance(const ExpandedFst<Arc>& fst,
+                  vector<typename Arc::Weight> * d,
+                  bool reverse, int threads, bool tropical)
+{
+    if (threads > 1) {
+        if (fst.Properties(kAcyclic, true)) {
+            ParallelDistance<Arc>(fst, reverse).levels(d, threads);
+            return;
+        }
+        if (tropical
+            && ParallelDistance<Arc>(fst, reverse).delta_stepping(d, threads))
+            return;
+    }
+    ShortestDistance(fst, d, reverse);
+}
+
+#endif // _parallel_distance_h
@@ -0,0 +1,259 @@
+#ifndef _path_iterator_h
+#define _path_iterator_h
+
+// Lazy n-best path enumeration.  Partial paths wait in a heap ordered
+// by their cost so far plus the exact cost of their best completion
+// (a backward shortest distance), so complete paths leave the heap in
+// order of cost, and taking the next one only expands the partial
+// paths cheaper than it: this is A* search with a perfect heuristic.
+// Weights are compared by value as tropical costs, which is also what
+// best_paths() does for the log semiring.
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <set>
+#include <vector>
+using namespace std;
+using namespace fst;
+
+/// Each state's cost to the nearest final state (infinite if none),
+/// by label-correcting search from the final states over incoming
+/// arcs.
+template <class Arc>
+void
+future_costs(const ExpandedFst<Arc>& fst, vector<float> * beta)
+{
+    typedef typename Arc::StateId StateId;
+    StateId n = fst.NumStates();
+    vector<size_t> off(n + 1, 0);
+    for (StateId s = 0; s < n; s++)
+        for (ArcIterator<ExpandedFst<Arc> > ai(fst, s); !ai.Done(); ai.Next())
+            off[ai.Value().nextstate + 1]++;
+    for (StateId s = 0; s < n; s++)
+        off[s + 1] += off[s];
+    vector<pair<StateId, float> > in(off[n]);
+    {
+        vector<size_t> pos(off.begin(), off.end() - 1);
+        for (StateId s = 0; s < n; s++)
+            for (ArcIterator<ExpandedFst<Arc> > ai(fst, s);
+                 !ai.Done(); ai.Next())
+                in[pos[ai.Value().nextstate]++]
+                    = make_pair(s, ai.Value().weight.Value());
+    }
+
+    vector<float>& b = *beta;
+    b.resize(n);
+    vector<bool> queued(n, false);
+    deque<StateId> queue;
+    for (StateId s = 0; s < n; s++) {
+        b[s] = fst.Final(s).Value();
+        if (b[s] < Arc::Weight::Zero().Value()) {
+            queue.push_back(s);
+            queued[s] = true;
+        }
+    }
+    while (!queue.empty()) {
+        StateId t = queue.front();
+        queue.pop_front();
+        queued[t] = false;
+        for (size_t i = off[t]; i < off[t + 1]; i++) {
+            StateId s = in[i].first;
+            float c = in[i].second + b[t];
+            if (c < b[s]) {
+                b[s] = c;
+                if (!queued[s]) {
+                    queued[s] = true;
+                    queue.push_back(s);
+                }
+            }
+        }
+    }
+}
+
+template <class Arc>
+class PathEnumerator : public PathIterator
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Label Label;
+    typedef typename Arc::Weight Weight;
+
+    /// Takes ownership of FST.  With UNIQUE, skip paths whose output
+    /// labels repeat an earlier path's.  BETA, FST's future_costs(),
+    /// is computed if not given, and must otherwise outlive this.
+    PathEnumerator(MutableFst<Arc> * fst, bool unique,
+                   const vector<float> * beta = NULL);
+    ~PathEnumerator()
+        { delete fst_; }
+
+    virtual bool next(vector<int>& in, vector<int>& out, float& cost);
+    /// The next path's arcs and final weight.
+    bool next(vector<Arc>& arcs, Weight& final);
+    virtual SymbolTable * InputSymbols() const
+        { return (SymbolTable *)fst_->InputSymbols(); }
+    virtual SymbolTable * OutputSymbols() const
+        { return (SymbolTable *)fst_->OutputSymbols(); }
+
+private:
+    // Partial paths share prefixes: each node is one arc on from its
+    // parent's end, or with STATE kNoStateId, the parent's path ended.
+    struct node
+    {
+        int parent;
+        Label ilabel, olabel;
+        Weight weight;              // of the arc, or the final weight
+        StateId state;
+        float cost;
+        node(int p, Label i, Label o, Weight w, StateId s, float c)
+            : parent(p), ilabel(i), olabel(o), weight(w), state(s),
+              cost(c) { }
+    };
+    typedef pair<float, int> Entry;
+
+    int advance();
+    void labels(int n, vector<int>& in, vector<int>& out) const;
+    void push(const node& n, float rest);
+
+    MutableFst<Arc> * fst_;
+    bool unique_;
+    const vector<float> * beta_;    // best cost from each state on
+    vector<float> own_beta_;
+    vector<node> nodes_;
+    priority_queue<Entry, vector<Entry>, greater<Entry> > heap_;
+    set<vector<int> > seen_;        // outputs so far, if unique_
+
+    PathEnumerator(const PathEnumerator& ); // disallow
+    void operator=(const PathEnumerator& );
+};
+
+template <class Arc>
+PathEnumerator<Arc>::PathEnumerator(MutableFst<Arc> * fst, bool unique,
+                                    const vector<float> * beta)
+    : fst_(fst), unique_(unique), beta_(beta)
+{
+    if (!beta_) {
+        future_costs(*fst_, &own_beta_);
+        beta_ = &own_beta_;
+    }
+    StateId s = fst_->Start();
+    if (s != kNoStateId && (*beta_)[s] < Weight::Zero().Value())
+        push(node(-1, 0, 0, Weight::One(), s, 0), (*beta_)[s]);
+}
+
+template <class Arc>
+void
+PathEnumerator<Arc>::push(const node& n, float rest)
+{
+    nodes_.push_back(n);
+    heap_.push(Entry(n.cost + rest, nodes_.size() - 1));
+}
+
+/// The non-epsilon labels along node N's path.
+template <class Arc>
+void
+PathEnumerator<Arc>::labels(int n, vector<int>& in, vector<int>& out) const
+{
+    in.clear();
+    out.clear();
+    for (; n >= 0; n = nodes_[n].parent) {
+        if (nodes_[n].ilabel)
+            in.push_back(nodes_[n].ilabel);
+        if (nodes_[n].olabel)
+            out.push_back(nodes_[n].olabel);
+    }
+    reverse(in.begin(), in.end());
+    reverse(out.begin(), out.end());
+}
+
+/// Search on to the next complete path, returning its end node, or
+/// -1 if there are no more.
+template <class Arc>
+int
+PathEnumerator<Arc>::advance()
+{
+    float inf = Weight::Zero().Value();
+    vector<int> in, out;
+    while (!heap_.empty()) {
+        int i = heap_.top().second;
+        heap_.pop();
+        // Copy: nodes_ grows below.
+        node n = nodes_[i];
+        if (n.state == kNoStateId) {
+            if (unique_) {
+                labels(i, in, out);
+                if (!seen_.insert(out).second)
+                    continue;
+            }
+            return i;
+        }
+        Weight f = fst_->Final(n.state);
+        if (f.Value() < inf)
+            push(node(i, 0, 0, f, kNoStateId, n.cost + f.Value()), 0);
+        for (ArcIterator<MutableFst<Arc> > ai(*fst_, n.state);
+             !ai.Done(); ai.Next()) {
+            const Arc& a = ai.Value();
+            float rest = (*beta_)[a.nextstate];
+            if (rest < inf)
+                push(node(i, a.ilabel, a.olabel, a.weight, a.nextstate,
+                          n.cost + a.weight.Value()), rest);
+        }
+    }
+    return -1;
+}
+
+template <class Arc>
+bool
+PathEnumerator<Arc>::next(vector<int>& in, vector<int>& out, float& cost)
+{
+    int i = advance();
+    if (i < 0)
+        return false;
+    labels(i, in, out);
+    cost = nodes_[i].cost;
+    return true;
+}
+
+template <class Arc>
+bool
+PathEnumerator<Arc>::next(vector<Arc>& arcs, Weight& final)
+{
+    int i = advance();
+    if (i < 0)
+        return false;
+    final = nodes_[i].weight;
+    arcs.clear();
+    for (i = nodes_[i].parent; nodes_[i].parent >= 0; i = nodes_[i].parent) {
+        const node& n = nodes_[i];
+        arcs.push_back(Arc(n.ilabel, n.olabel, n.weight, n.state));
+    }
+    reverse(arcs.begin(), arcs.end());
+    return true;
+}
+
+/// Write the N best paths of FST into OFST, which share only the start
+/// state, using FST's future_costs() BETA as the A* heuristic.
+template <class Arc>
+void
+astar_paths(const MutableFst<Arc>& fst, const vector<float>& beta,
+            unsigned n, bool unique, MutableFst<Arc> * ofst)
+{
+    ofst->DeleteStates();
+    PathEnumerator<Arc> paths(fst.Copy(), unique, &beta);
+    vector<Arc> arcs;
+    typename Arc::Weight final;
+    for (unsigned k = 0; k < n && paths.next(arcs, final); k++) {
+        if (ofst->Start() == kNoStateId)
+            ofst->SetStart(ofst->AddState());
+        typename Arc::StateId s = ofst->Start();
+        for (size_t i = 0; i < arcs.size(); i++) {
+            Arc a = arcs[i];
+            a.nextstate = ofst->AddState();
+            ofst->AddArc(s, a);
+            s = a.nextstate;
+        }
+        ofst->SetFinal(s, final);
+    }
+}
+
+#endif // _path_iterator_h
@@ -0,0 +1,217 @@
+#ifndef _posteriors_h
+#define _posteriors_h
+
+// Arc posteriors of an acyclic FST whose weights are negative log
+// probabilities, by the forward-backward algorithm.  The FST is read
+// once into flat arrays of arc costs and endpoints, in both
+// directions; each pass visits the states in topological order and
+// combines a state's arcs by gathering their costs into a contiguous
+// buffer and log-adding it four at a time with SSE2, using a
+// polynomial exp, or one at a time where SSE2 is missing.
+
+#include <cmath>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+using namespace fst;
+
+#ifdef __SSE2__
+/// exp of four floats, as in Cephes' expf: X = n ln 2 + r with |r| <=
+/// ln(2)/2, e^r by a polynomial, and 2^n put in the exponent bits.
+/// Within a few ulps; X is clamped to [-87, 88], so -inf gives a
+/// negligible 1.6e-38 rather than 0.
+inline __m128
+exp4(__m128 x)
+{
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+    // n = floor(x / ln 2 + 1/2), without SSE4's floor.
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)),
+                           _mm_set1_ps(0.5f));
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    fx = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, fx), _mm_set1_ps(1.0f)));
+    // ln 2 in two parts, so that r keeps its low bits.
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+    __m128 y = _mm_set1_ps(1.9875691500e-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+    y = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, x), x),
+                   _mm_add_ps(x, _mm_set1_ps(1.0f)));
+    __m128i e = _mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127));
+    return _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(e, 23)));
+}
+#endif
+
+template <class Arc>
+class ArcPosteriors
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Weight Weight;
+
+    explicit ArcPosteriors(const ExpandedFst<Arc>& fst);
+
+    /// Each arc's posterior probability, in the order of states and
+    /// then of their arcs.  False if the FST is cyclic.
+    bool run(vector<float> * post);
+
+private:
+    float log_add(size_t n) const;
+    bool sort();
+
+    StateId n, start;
+    float inf;
+    vector<float> final;
+    // Arcs out of each state, in order...
+    vector<size_t> ooff;
+    vector<StateId> odst;
+    vector<float> ocost;
+    // ... and into each state.
+    vector<size_t> ioff;
+    vector<StateId> isrc;
+    vector<float> icost;
+
+    vector<StateId> order;          // topological
+    vector<float> alpha, beta;
+    vector<float> buf;
+};
+
+template <class Arc>
+ArcPosteriors<Arc>::ArcPosteriors(const ExpandedFst<Arc>& fst)
+    : n(fst.NumStates()), start(fst.Start()), inf(Weight::Zero().Value())
+{
+    final.resize(n);
+    ooff.assign(n + 1, 0);
+    ioff.assign(n + 1, 0);
+    for (StateId s = 0; s < n; s++) {
+        final[s] = fst.Final(s).Value();
+        for (ArcIterator<ExpandedFst<Arc> > ai(fst, s); !ai.Done(); ai.Next()) {
+            const Arc& a = ai.Value();
+            odst.push_back(a.nextstate);
+            ocost.push_back(a.weight.Value());
+            ioff[a.nextstate + 1]++;
+        }
+        ooff[s + 1] = odst.size();
+    }
+    for (StateId s = 0; s < n; s++)
+        ioff[s + 1] += ioff[s];
+    isrc.resize(odst.size());
+    icost.resize(odst.size());
+    vector<size_t> pos(ioff.begin(), ioff.end() - 1);
+    for (StateId s = 0; s < n; s++)
+        for (size_t j = ooff[s]; j < ooff[s + 1]; j++) {
+            size_t i = pos[odst[j]]++;
+            isrc[i] = s;
+            icost[i] = ocost[j];
+        }
+}
+
+/// -log of the sum of exp(-x) over the first N costs in buf.
+template <class Arc>
+float
+ArcPosteriors<Arc>::log_add(size_t n) const
+{
+    const float * x = n ? &buf[0] : NULL;
+    float m = inf, sum = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    float lane[4];
+    if (n >= 4) {
+        __m128 m4 = _mm_loadu_ps(x);
+        for (i = 4; i + 4 <= n; i += 4)
+            m4 = _mm_min_ps(m4, _mm_loadu_ps(x + i));
+        _mm_storeu_ps(lane, m4);
+        m = min(min(lane[0], lane[1]), min(lane[2], lane[3]));
+    }
+#endif
+    for (; i < n; i++)
+        m = x[i] < m ? x[i] : m;
+    if (!(m < inf))
+        return inf;
+    i = 0;
+#ifdef __SSE2__
+    __m128 m4 = _mm_set1_ps(m), s4 = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+        s4 = _mm_add_ps(s4, exp4(_mm_sub_ps(m4, _mm_loadu_ps(x + i))));
+    _mm_storeu_ps(lane, s4);
+    sum = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+#endif
+    for (; i < n; i++)
+        sum += exp(m - x[i]);
+    return m - log(sum);
+}
+
+/// Kahn's algorithm.  False if there is a cycle.
+template <class Arc>
+bool
+ArcPosteriors<Arc>::sort()
+{
+    vector<size_t> indeg(n);
+    order.clear();
+    for (StateId v = 0; v < n; v++)
+        if (!(indeg[v] = ioff[v + 1] - ioff[v]))
+            order.push_back(v);
+    for (size_t i = 0; i < order.size(); i++) {
+        StateId u = order[i];
+        for (size_t j = ooff[u]; j < ooff[u + 1]; j++)
+            if (!--indeg[odst[j]])
+                order.push_back(odst[j]);
+    }
+    return order.size() == (size_t)n;
+}
+
+template <class Arc>
+bool
+ArcPosteriors<Arc>::run(vector<float> * post)
+{
+    post->assign(odst.size(), 0);
+    if (!sort())
+        return false;
+    if (start == kNoStateId)
+        return true;
+    size_t widest = 0;
+    for (StateId s = 0; s < n; s++) {
+        widest = max(widest, ooff[s + 1] - ooff[s]);
+        widest = max(widest, ioff[s + 1] - ioff[s]);
+    }
+    buf.resize(widest + 1);
+
+    alpha.resize(n);
+    for (size_t i = 0; i < order.size(); i++) {
+        StateId v = order[i];
+        size_t k = 0;
+        if (v == start)
+            buf[k++] = 0;
+        for (size_t j = ioff[v]; j < ioff[v + 1]; j++)
+            buf[k++] = alpha[isrc[j]] + icost[j];
+        alpha[v] = log_add(k);
+    }
+    beta.resize(n);
+    for (size_t i = order.size(); i-- > 0; ) {
+        StateId v = order[i];
+        size_t k = 0;
+        buf[k++] = final[v];
+        for (size_t j = ooff[v]; j < ooff[v + 1]; j++)
+            buf[k++] = ocost[j] + beta[odst[j]];
+        beta[v] = log_add(k);
+    }
+
+    float total = beta[start];
+    if (!(total < inf))
+        return true;
+    for (StateId s = 0; s < n; s++) {
+        if (!(alpha[s] < inf))
+            continue;
+        float a = alpha[s] - total;
+        for (size_t j = ooff[s]; j < ooff[s + 1]; j++)
+            (*post)[j] = exp(-(a + ocost[j] + beta[odst[j]]));
+    }
+    return true;
+}
+
+#endif // _posteriors_h
@@ -0,0 +1,111 @@
+#ifndef _real_weight_h
+#define _real_weight_h
+
+// The real (probability) semiring: Plus and Times are ordinary float
+// addition and multiplication, with Zero 0 and One 1.  For short
+// acyclic lattices this avoids the exp and log in every log-semiring
+// Plus.  It is neither idempotent nor a path semiring, so shortest
+// paths and pruning go through the tropical semiring (see
+// change_semiring()), and distances need an acyclic FST.
+
+#include <cmath>
+#include <string>
+using namespace std;
+using namespace fst;
+
+class RealWeight : public FloatWeight
+{
+public:
+    typedef RealWeight ReverseWeight;
+
+    RealWeight() : FloatWeight() { }
+    RealWeight(float f) : FloatWeight(f) { }
+    RealWeight(const FloatWeight& w) : FloatWeight(w) { }
+
+    static const RealWeight Zero()
+        { return RealWeight(0.0F); }
+    static const RealWeight One()
+        { return RealWeight(1.0F); }
+    static const string& Type()
+        {
+            static const string type = "real";
+            return type;
+        }
+    bool Member() const
+        { return Value() == Value(); }
+    RealWeight Quantize(float delta = kDelta) const
+        { return RealWeight(floor(Value() / delta + 0.5F) * delta); }
+    RealWeight Reverse() const
+        { return *this; }
+    static uint64 Properties()
+        { return kLeftSemiring | kRightSemiring | kCommutative; }
+};
+
+inline RealWeight
+Plus(const RealWeight& w1, const RealWeight& w2)
+{ return RealWeight(w1.Value() + w2.Value()); }
+
+inline RealWeight
+Times(const RealWeight& w1, const RealWeight& w2)
+{ return RealWeight(w1.Value() * w2.Value()); }
+
+inline RealWeight
+Divide(const RealWeight& w1, const RealWeight& w2,
+       DivideType = DIVIDE_ANY)
+{ return RealWeight(w1.Value() / w2.Value()); }
+
+struct RealArc
+{
+    typedef int Label;
+    typedef RealWeight Weight;
+    typedef int StateId;
+
+    RealArc() { }
+    RealArc(Label i, Label o, Weight w, StateId s)
+        : ilabel(i), olabel(o), weight(w), nextstate(s) { }
+
+    static const string& Type()
+        {
+            static const string type = "real";
+            return type;
+        }
+
+    Label ilabel;
+    Label olabel;
+    Weight weight;
+    StateId nextstate;
+};
+
+/// Arc-by-arc conversion from costs (-log probabilities) to
+/// probabilities.
+template <class A>
+struct to_real_mapper
+{
+    RealArc operator()(const A& a) const
+        {
+            return RealArc(a.ilabel, a.olabel, exp(-a.weight.Value()),
+                           a.nextstate);
+        }
+    MapFinalAction FinalAction() const
+        { return MAP_NO_SUPERFINAL; }
+    uint64 Properties(uint64 props) const
+        { return props; }
+};
+
+/// ... and back.
+template <class B>
+struct from_real_mapper
+{
+    B operator()(const RealArc& a) const
+        {
+            float p = a.weight.Value();
+            // Not -log(1), which is -0.
+            return B(a.ilabel, a.olabel, p == 1 ? 0 : -log(p), a.nextstate);
+        }
+    MapFinalAction FinalAction() const
+        { return MAP_NO_SUPERFINAL; }
+    uint64 Properties(uint64 props) const
+        { return props; }
+};
+
+#endif // _real_weight_h
@@ -0,0 +1,321 @@
+#ifndef _refine_h
+#define _refine_h
+
+// Multi-threaded minimization by signature refinement.  Each round
+// gives every state the signature (class, final weight, outgoing
+// (label, target class) pairs), and states keep sharing a class only
+// if their signatures match; the partition is stable when a round
+// splits nothing.  Signatures are hashed in parallel, and states are
+// grouped in a fixed number of hash shards, also in parallel, so the
+// result does not depend on the number of threads.  Like
+// fst::Minimize, this expects a deterministic input.
+//
+// A round costs O(n + E), but a round may split off as little as one
+// state, so inputs like a long chain take O(n) rounds.  Refinement
+// therefore gives up after O(log n) rounds, and parallel_minimize()
+// then finishes with fst::Minimize, whose O(E log n) bound holds
+// whatever the shape.
+
+#include <algorithm>
+#include <vector>
+#include "threads.h"
+#include "fingerprint.h"
+using namespace std;
+using namespace fst;
+
+template <class Arc>
+class Refiner
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Label Label;
+    typedef typename Arc::Weight Weight;
+
+    /// FST must be an unweighted acceptor: arc weights are dropped.
+    explicit Refiner(const MutableFst<Arc>& fst);
+
+    /// Refine until stable on up to THREADS threads, then replace
+    /// FST's contents with the quotient.  Returns false, leaving FST
+    /// alone, if that takes more than O(log n) rounds.
+    bool run(MutableFst<Arc> * fst, int threads);
+
+private:
+    enum { NSHARD = 64, GRAIN = 4096 };
+
+    // Flattened input.  Arcs of state s are [off[s], off[s+1]),
+    // sorted by label and target.
+    vector<size_t> off;
+    vector<Label> lab;
+    vector<StateId> dst;
+    vector<Weight> final;
+    StateId start;
+
+    vector<StateId> cls, next_cls;
+    vector<uint64> hash;
+    vector<StateId> order;          // states grouped by shard
+    vector<size_t> shard_off;       // shard s is order[shard_off[s]..]
+    vector<StateId> local;          // class within the shard
+    vector<StateId> shard_count;
+
+    StateId nstates() const
+        { return final.size(); }
+    uint64 signature(StateId s) const;
+    bool same(StateId a, StateId b) const;
+    StateId round(int threads);
+
+    struct hash_job
+    {
+        Refiner * r;
+        void operator()(int s, int)
+            { r->hash[s] = r->signature(s); }
+    };
+    struct group_job
+    {
+        Refiner * r;
+        void operator()(int shard, int);
+    };
+    struct quotient_job
+    {
+        const Refiner * r;
+        const vector<StateId> * rep;
+        const vector<size_t> * qoff;
+        vector<StateId> * qdst;
+        void operator()(int c, int)
+            {
+                StateId s = (*rep)[c];
+                size_t j = (*qoff)[c];
+                for (size_t i = r->off[s]; i < r->off[s + 1]; i++)
+                    (*qdst)[j++] = r->cls[r->dst[i]];
+            }
+    };
+
+    struct arc_less
+    {
+        const Refiner * r;
+        bool operator()(size_t a, size_t b) const
+            {
+                return r->lab[a] < r->lab[b]
+                    || (r->lab[a] == r->lab[b] && r->dst[a] < r->dst[b]);
+            }
+    };
+};
+
+template <class Arc>
+Refiner<Arc>::Refiner(const MutableFst<Arc>& fst)
+    : start(fst.Start())
+{
+    StateId n = fst.NumStates();
+    off.resize(n + 1);
+    final.reserve(n);
+    vector<size_t> idx;
+    vector<Label> l;
+    vector<StateId> d;
+    off[0] = 0;
+    for (StateId s = 0; s < n; s++) {
+        final.push_back(fst.Final(s));
+        size_t first = lab.size();
+        for (ArcIterator<MutableFst<Arc> > ai(fst, s); !ai.Done(); ai.Next()) {
+            lab.push_back(ai.Value().ilabel);
+            dst.push_back(ai.Value().nextstate);
+        }
+        off[s + 1] = lab.size();
+        // Sort this state's arcs so equal signatures compare equal.
+        size_t na = lab.size() - first;
+        idx.resize(na);
+        for (size_t i = 0; i < na; i++)
+            idx[i] = first + i;
+        arc_less cmp = { this };
+        sort(idx.begin(), idx.end(), cmp);
+        l.resize(na);
+        d.resize(na);
+        for (size_t i = 0; i < na; i++) {
+            l[i] = lab[idx[i]];
+            d[i] = dst[idx[i]];
+        }
+        copy(l.begin(), l.end(), lab.begin() + first);
+        copy(d.begin(), d.end(), dst.begin() + first);
+    }
+    cls.assign(n, 0);
+    next_cls.resize(n);
+    hash.resize(n);
+    order.resize(n);
+    local.resize(n);
+    shard_off.resize(NSHARD + 1);
+    shard_count.resize(NSHARD);
+}
+
+template <class Arc>
+uint64
+Refiner<Arc>::signature(StateId s) const
+{
+    uint64 h = hash_mix(cls[s], float_bits(final[s].Value()));
+    for (size_t i = off[s]; i < off[s + 1]; i++)
+        h = hash_mix(hash_mix(h, lab[i]), cls[dst[i]]);
+    return h;
+}
+
+template <class Arc>
+bool
+Refiner<Arc>::same(StateId a, StateId b) const
+{
+    if (cls[a] != cls[b] || final[a] != final[b]
+        || off[a + 1] - off[a] != off[b + 1] - off[b])
+        return false;
+    for (size_t i = off[a], j = off[b]; i < off[a + 1]; i++, j++)
+        if (lab[i] != lab[j] || cls[dst[i]] != cls[dst[j]])
+            return false;
+    return true;
+}
+
+/// Number the distinct signatures within one shard, in state order.
+template <class Arc>
+void
+Refiner<Arc>::group_job::operator()(int shard, int)
+{
+    // Class representatives, chained by hash bucket.
+    vector<StateId> reps, chain;
+    vector<StateId> heads;
+    size_t lo = r->shard_off[shard], hi = r->shard_off[shard + 1];
+    size_t nb = 16;
+    while (nb < 2 * (hi - lo))
+        nb *= 2;
+    heads.assign(nb, -1);
+    for (size_t i = lo; i < hi; i++) {
+        StateId s = r->order[i];
+        size_t b = (r->hash[s] / NSHARD) & (nb - 1);
+        StateId c = heads[b];
+        for (; c >= 0; c = chain[c])
+            if (r->hash[reps[c]] == r->hash[s] && r->same(reps[c], s))
+                break;
+        if (c < 0) {
+            c = reps.size();
+            reps.push_back(s);
+            chain.push_back(heads[b]);
+            heads[b] = c;
+        }
+        r->local[s] = c;
+    }
+    r->shard_count[shard] = reps.size();
+}
+
+/// One refinement round; returns the new number of classes.
+template <class Arc>
+typename Refiner<Arc>::StateId
+Refiner<Arc>::round(int threads)
+{
+    StateId n = nstates();
+    hash_job hj = { this };
+    parallel_for(n, threads, hj, GRAIN);
+
+    // Counting sort by shard keeps state order within each shard.
+    fill(shard_off.begin(), shard_off.end(), 0);
+    for (StateId s = 0; s < n; s++)
+        shard_off[hash[s] % NSHARD + 1]++;
+    for (int i = 0; i < NSHARD; i++)
+        shard_off[i + 1] += shard_off[i];
+    vector<size_t> pos(shard_off.begin(), shard_off.end() - 1);
+    for (StateId s = 0; s < n; s++)
+        order[pos[hash[s] % NSHARD]++] = s;
+
+    group_job gj = { this };
+    parallel_for(NSHARD, threads, gj);
+
+    vector<StateId> base(NSHARD);
+    StateId total = 0;
+    for (int i = 0; i < NSHARD; i++) {
+        base[i] = total;
+        total += shard_count[i];
+    }
+    for (StateId s = 0; s < n; s++)
+        next_cls[s] = base[hash[s] % NSHARD] + local[s];
+    cls.swap(next_cls);
+    return total;
+}
+
+template <class Arc>
+bool
+Refiner<Arc>::run(MutableFst<Arc> * fst, int threads)
+{
+    StateId n = nstates();
+    if (n == 0)
+        return true;
+    int max_rounds = 8;
+    for (StateId i = n; i > 0; i >>= 1)
+        max_rounds += 2;
+    StateId count = 1, prev;
+    do {
+        if (max_rounds-- == 0)
+            return false;
+        prev = count;
+        count = round(threads);
+    } while (count != prev);
+
+    // Renumber classes by their first state, so the output matches the
+    // input's state order.
+    vector<StateId> rename(count, -1), rep;
+    rep.reserve(count);
+    for (StateId s = 0; s < n; s++) {
+        if (rename[cls[s]] < 0) {
+            rename[cls[s]] = rep.size();
+            rep.push_back(s);
+        }
+        cls[s] = rename[cls[s]];
+    }
+    vector<size_t> qoff(count + 1);
+    qoff[0] = 0;
+    for (StateId c = 0; c < count; c++)
+        qoff[c + 1] = qoff[c] + off[rep[c] + 1] - off[rep[c]];
+    vector<StateId> qdst(qoff[count]);
+    quotient_job qj = { this, &rep, &qoff, &qdst };
+    parallel_for(count, threads, qj, GRAIN);
+
+    fst->DeleteStates();
+    for (StateId c = 0; c < count; c++)
+        fst->AddState();
+    if (start != kNoStateId)
+        fst->SetStart(cls[start]);
+    for (StateId c = 0; c < count; c++) {
+        StateId s = rep[c];
+        fst->SetFinal(c, final[s]);
+        for (size_t i = off[s], j = qoff[c]; i < off[s + 1]; i++, j++)
+            fst->AddArc(c, Arc(lab[i], lab[i], Weight::One(), qdst[j]));
+    }
+    return true;
+}
+
+/// The steps fst::Minimize takes before minimizing an acceptor:
+/// trim, push weights to the start, quantize, and encode labels and
+/// weights, leaving an unweighted acceptor to be decoded with ENC.
+template <class Arc>
+void
+minimize_prepare(MutableFst<Arc> * fst, EncodeMapper<Arc> * enc,
+                 float delta = kDelta)
+{
+    Connect(fst);
+    if (!fst->Properties(kUnweighted, true)) {
+        Push(fst, REWEIGHT_TO_INITIAL);
+        Map(fst, QuantizeMapper<Arc>(delta));
+    }
+    Encode(fst, enc);
+}
+
+/// Minimize FST in place on up to THREADS threads.  FLAGS says what
+/// to encode; labels need not be if FST is already an acceptor.
+template <class Arc>
+void
+parallel_minimize(MutableFst<Arc> * fst, int threads,
+                  uint32 flags = ENCODE_LABEL | ENCODE_WEIGHT)
+{
+    EncodeMapper<Arc> enc(flags, ENCODE);
+    minimize_prepare(fst, &enc);
+    bool done;
+    {
+        Refiner<Arc> r(*fst);
+        done = r.run(fst, threads);
+    }
+    if (!done)
+        fst::Minimize(fst);
+    Decode(fst, enc);
+}
+
+#endif // _refine_h
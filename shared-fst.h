@@ -0,0 +1,70 @@
+#ifndef _shared_fst_h
+#define _shared_fst_h
+
+// A read-only view that lets several threads use one FST at once.
+// Copying a VectorFst bumps a non-atomic reference count, and asking
+// for uncomputed properties writes them back, so handing the same
+// VectorFst to concurrent algorithms corrupts it.  SharedFst computes
+// the properties once up front and copies itself without touching the
+// underlying FST.  The underlying FST must outlive every view and must
+// not change while they are in use.
+
+using namespace fst;
+
+template <class A>
+class SharedFst : public Fst<A>
+{
+public:
+    typedef A Arc;
+    typedef typename A::Weight Weight;
+    typedef typename A::StateId StateId;
+
+    /// Not thread-safe: construct all views before starting threads.
+    explicit SharedFst(const Fst<A>& f)
+        : fst_(f), props_(f.Properties(kFstProperties, true)) { }
+    /// Thread-safe if PROPS were already known (e.g. computed by an
+    /// earlier Properties(..., true) call and read back without test).
+    SharedFst(const Fst<A>& f, uint64 props)
+        : fst_(f), props_(props) { }
+    SharedFst(const SharedFst<A>& f)
+        : Fst<A>(), fst_(f.fst_), props_(f.props_) { }
+
+    virtual StateId Start() const
+        { return fst_.Start(); }
+    virtual Weight Final(StateId s) const
+        { return fst_.Final(s); }
+    virtual size_t NumArcs(StateId s) const
+        { return fst_.NumArcs(s); }
+    virtual size_t NumInputEpsilons(StateId s) const
+        { return fst_.NumInputEpsilons(s); }
+    virtual size_t NumOutputEpsilons(StateId s) const
+        { return fst_.NumOutputEpsilons(s); }
+    virtual uint64 Properties(uint64 mask, bool) const
+        { return props_ & mask; }
+    virtual const string& Type() const
+        {
+            static const string type("shared");
+            return type;
+        }
+    virtual SharedFst<A> * Copy() const
+        { return new SharedFst<A>(*this); }
+    // Symbol tables are reference-counted as well, and algorithms such
+    // as Compose copy them into their result, so the view has none.
+    // Attach the tables to results on the calling thread.
+    virtual const SymbolTable * InputSymbols() const
+        { return NULL; }
+    virtual const SymbolTable * OutputSymbols() const
+        { return NULL; }
+    virtual void InitStateIterator(StateIteratorData<A> * data) const
+        { fst_.InitStateIterator(data); }
+    virtual void InitArcIterator(StateId s, ArcIteratorData<A> * data) const
+        { fst_.InitArcIterator(s, data); }
+
+private:
+    const Fst<A>& fst_;
+    uint64 props_;
+
+    void operator=(const SharedFst<A>& ); // disallow
+};
+
+#endif // _shared_fst_h
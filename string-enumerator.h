@@ -0,0 +1,120 @@
+#ifndef _string_enumerator_h
+#define _string_enumerator_h
+
+// Depth-first enumeration of the label strings of an FST's successful
+// paths, one at a time.  The search keeps an explicit stack of states
+// and arc positions and a single buffer of the labels on the current
+// path, so it can stop after any string and resume later.  By default
+// a path never re-enters a state already on it, so cyclic FSTs yield
+// their simple paths; with CYCLES, states may repeat and MAX_LENGTH
+// must bound the search.
+
+#include <vector>
+using namespace std;
+using namespace fst;
+
+template <class Arc>
+class StringEnumerator : public StringIterator
+{
+public:
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Label Label;
+    typedef typename Arc::Weight Weight;
+
+    /// Takes ownership of FST.  Strings are of output labels if OUTPUT,
+    /// else input labels.  MAX_COUNT strings and paths of MAX_LENGTH
+    /// arcs at most; 0 means no limit.
+    StringEnumerator(MutableFst<Arc> * fst, bool output, size_t max_count,
+                     size_t max_length, bool cycles);
+    ~StringEnumerator()
+        { delete fst_; }
+
+    virtual bool next(vector<int>& labels);
+    virtual bool truncated() const
+        { return truncated_; }
+    virtual SymbolTable * Symbols() const
+        {
+            return (SymbolTable *)(output_ ? fst_->OutputSymbols()
+                                   : fst_->InputSymbols());
+        }
+
+private:
+    struct frame
+    {
+        StateId state;
+        size_t pos;                 // next arc to follow
+        bool labelled;              // whether it added to path_
+        bool visited;               // whether its finality was checked
+    };
+
+    MutableFst<Arc> * fst_;
+    bool output_, cycles_;
+    size_t max_count_, max_length_;
+    size_t count_;
+    bool truncated_;
+    vector<frame> stack_;
+    vector<int> path_;
+    vector<bool> on_path_;          // unless CYCLES
+};
+
+template <class Arc>
+StringEnumerator<Arc>::StringEnumerator(MutableFst<Arc> * fst, bool output,
+                                        size_t max_count, size_t max_length,
+                                        bool cycles)
+    : fst_(fst), output_(output), cycles_(cycles), max_count_(max_count),
+      max_length_(max_length), count_(0), truncated_(false),
+      on_path_(fst->NumStates(), false)
+{
+    if (fst_->Start() != kNoStateId) {
+        frame f = { fst_->Start(), 0, false, false };
+        stack_.push_back(f);
+        on_path_[f.state] = true;
+    }
+}
+
+template <class Arc>
+bool
+StringEnumerator<Arc>::next(vector<int>& labels)
+{
+    if (max_count_ && count_ >= max_count_) {
+        if (!stack_.empty())
+            truncated_ = true;
+        return false;
+    }
+    while (!stack_.empty()) {
+        frame& f = stack_.back();
+        if (!f.visited) {
+            f.visited = true;
+            if (fst_->Final(f.state) != Weight::Zero()) {
+                labels = path_;
+                count_++;
+                return true;
+            }
+        }
+        ArcIterator<MutableFst<Arc> > ai(*fst_, f.state);
+        ai.Seek(f.pos);
+        if (ai.Done()) {
+            on_path_[f.state] = false;
+            if (f.labelled)
+                path_.pop_back();
+            stack_.pop_back();
+            continue;
+        }
+        f.pos++;
+        const Arc& a = ai.Value();
+        if ((!cycles_ && on_path_[a.nextstate])
+            || (max_length_ && stack_.size() > max_length_)) {
+            truncated_ = true;
+            continue;
+        }
+        Label l = output_ ? a.olabel : a.ilabel;
+        if (l)
+            path_.push_back(l);
+        on_path_[a.nextstate] = true;
+        frame g = { a.nextstate, 0, l != 0, false };
+        stack_.push_back(g);
+    }
+    return false;
+}
+
+#endif // _string_enumerator_h
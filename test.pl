@@ -1,4 +1,4 @@
-use Test::Simple tests => 4;
+use Test::Simple tests => 36;
 use Algorithm::OpenFST;
 ok(1, 'loaded');
 
@@ -70,3 +70,264 @@ ok($fsa->Compose($fst).'' eq <<EOS);
 9	10	1	6
 10
 EOS
+
+my @syms = qw(a b);
+my $swap = Algorithm::OpenFST::from_list(0, 0, \@syms,
+                                         [0, 0, 'a', 'b'], [0, 0, 'b', 'a']);
+my @words = map {
+    Algorithm::OpenFST::from_list(0, 2, \@syms, [0, 1, $_->[0], $_->[0]],
+                                  [1, 2, $_->[1], $_->[1]]);
+} [qw(a b)], [qw(b b)], [qw(a a)];
+my @batch = Algorithm::OpenFST::compose_batch($swap, \@words, threads => 2);
+ok(join('|', @batch) eq join('|', map { $_->Compose($swap) } @words),
+   'compose_batch');
+
+Algorithm::OpenFST::cache_size(4);
+my $first = $words[0]->Compose($swap);
+my $again = $words[0]->Compose($swap);
+my %cache = Algorithm::OpenFST::cache_stats();
+ok("$first" eq "$again" && $cache{hits} == 1 && $cache{entries} == 1,
+   'result cache');
+Algorithm::OpenFST::cache_size(0);
+
+my $det = eval { $words[0]->determinize(max_states => 1) };
+ok(!$det && $@ =~ /stopped early/
+   && $words[0]->determinize(max_states => 10) eq $words[0]->Determinize,
+   'bounded determinize');
+
+my $loop = Algorithm::OpenFST::from_list(0, 2, \@syms,
+                                         [0, 1, 'a', 'a'], [1, 2, 'b', 'b'],
+                                         [2, 3, 'a', 'a'], [3, 2, 'b', 'b']);
+ok($loop->Minimize(2)->NumStates == 3 && $loop->Minimize->NumStates == 3,
+   'parallel minimize');
+
+my $lex = Algorithm::OpenFST::union(@words)->RmEpsilon->Determinize;
+my $mlex = $lex->Minimize;
+ok($mlex->NumStates == 4
+   && join('|', sort $mlex->strings) eq join('|', sort $lex->strings),
+   'acyclic minimize');
+
+my $lb = Algorithm::OpenFST::lexicon_builder();
+$lb->add($_) for qw(aa ab bb);
+my $built = $lb->finish;
+ok($built->NumStates == $mlex->NumStates
+   && join('|', sort $built->strings) eq join('|', sort $mlex->strings),
+   'lexicon builder');
+
+my $copies = Algorithm::OpenFST::copy_count();
+my $chain = $lex->Copy->RmEpsilon->Minimize->Invert;
+ok(Algorithm::OpenFST::copy_count() == $copies + 1
+   && join('|', sort $chain->strings) eq join('|', sort $lex->strings),
+   'temporaries are reused');
+
+my $eps = Algorithm::OpenFST::union(@words);
+ok(join('|', sort $eps->RmEpsilon(1.024e-3, 2)->strings)
+   eq join('|', sort $eps->RmEpsilon->strings), 'parallel RmEpsilon');
+
+ok($lex->Reverse(1) eq $lex->Reverse && $lex->Reverse(1)->Minimize
+   eq $lex->Reverse->Minimize, 'lazy Reverse');
+
+my ($opt, @stages) = $eps->optimize;
+ok(@stages == 4 && $opt->NumStates == $mlex->NumStates
+   && join('|', sort $opt->strings) eq join('|', sort $eps->RmEpsilon->strings),
+   'optimize');
+
+my ($dlex, $dst) = $eps->RmEpsilon->determinize(stats => 1);
+my $est = $eps->RmEpsilon->determinize_estimate(sample => 1000);
+ok(join('|', sort $dlex->strings) eq join('|', sort $lex->strings)
+   && $dst->{states} == $lex->NumStates
+   && $dst->{max_subset} >= 1 && $est->{complete}
+   && $est->{predicted_states} == $dst->{states}, 'determinize stats');
+
+my $it = $loop->paths;
+my @loops = map { join '', @{($it->next)[1]} } 1 .. 3;
+my $uit = $eps->paths(unique => 1);
+my @uniq;
+while (my ($in, $out, $cost) = $uit->next) {
+    push @uniq, join '', @$out;
+}
+ok(join('|', @loops) eq 'ab|abab|ababab'
+   && join('|', sort @uniq) eq 'aa|ab|bb', 'path iterator');
+
+my $costly = Algorithm::OpenFST::from_list(0, 2, \@syms,
+                                           [0, 1, 'a', 'a', 1],
+                                           [0, 1, 'b', 'b', 2],
+                                           [1, 2, 'b', 'b', 1]);
+ok(join('|', $costly->best_paths(1)->strings)
+   eq join('|', $words[0]->strings), 'log best paths');
+
+ok(join('|', $costly->best_paths(1, 0, 1)->strings)
+   eq join('|', $costly->best_paths(1)->strings)
+   && $lex->best_paths(3, 1, 1)->NumStates == 7, 'A* best paths');
+
+my $trop = $costly->change_semiring(Algorithm::OpenFST::SMRTropical);
+my @fwd = $trop->distances('forward');
+my @bwd = $trop->distances('backward');
+ok("@fwd" eq '0 1 2' && "@bwd" eq '2 1 0'
+   && $trop->prune(0.5)->NumStates == 3, 'cached distances');
+
+my $ptrop = $costly->change_semiring(Algorithm::OpenFST::SMRTropical);
+my $ploop = $loop->change_semiring(Algorithm::OpenFST::SMRTropical);
+ok(join(' ', $ptrop->distances('backward', 2)) eq "@bwd"
+   && join(' ', $ploop->distances('forward', 2))
+      eq join(' ', $loop->change_semiring(Algorithm::OpenFST::SMRTropical)
+                        ->distances('forward')),
+   'parallel distances');
+
+my ($swapped) = $swap->transduce([qw(a b a)]);
+my @two = $costly->transduce([qw(a b)], n => 2);
+ok(join('', @{$swapped->[0]}) eq 'bab' && $swapped->[1] == 0
+   && @two == 1 && join('', @{$two[0][0]}) eq 'ab' && $two[0][1] == 2,
+   'transduce');
+
+my @seqs = ([qw(a b)], [qw(b b a)], [qw(a b a b)]);
+my @decoded = Algorithm::OpenFST::decode_batch($swap, \@seqs, threads => 2);
+ok(join('|', map { join('', @{$_->[0][0]}) } @decoded)
+   eq join('|', map { join('', @{($swap->transduce($_))[0][0]}) } @seqs),
+   'decode_batch');
+
+my ($bout, $bcost, $bst) = $costly->beam_search([qw(a b)], beam => 0);
+my ($none) = $costly->beam_search([qw(b)]);
+ok(join('', @$bout) eq 'ab' && $bcost == 2 && $bst->{created} > 0
+   && $bst->{pool} <= $bst->{created} && !defined $none,
+   'beam_search');
+
+my $lattice = Algorithm::OpenFST::from_list(0, 2, \@syms,
+                                            [0, 1, 'a', 'a', 0],
+                                            [0, 1, 'b', 'b', 0],
+                                            [1, 2, 'a', 'a', 0]);
+my @post = unpack 'f*', $lattice->posteriors;
+ok(@post == 3 && abs($post[0] - 0.5) < 1e-6 && abs($post[1] - 0.5) < 1e-6
+   && abs($post[2] - 1) < 1e-6, 'posteriors');
+
+my $sit = $loop->string_iterator(cycles => 1, max_length => 6);
+my @first = $sit->next(2);
+my @rest = $sit->next_labels(10);
+ok(join('|', $loop->strings) eq 'a b' && join('|', $swap->strings) eq ''
+   && join('|', $loop->strings(cycles => 1, max_length => 4, sep => ''))
+      eq 'ab|abab'
+   && join('|', @first) eq 'a b|a b a b' && @rest == 1
+   && join('', @{$rest[0]}) eq 'ababab' && $sit->truncated
+   && join('|', $swap->strings(side => 'output', max => 3, cycles => 1,
+                               max_length => 1)) eq '|b|a',
+   'bounded strings');
+
+my $real = $lattice->change_semiring(Algorithm::OpenFST::SMRReal);
+ok($real->semiring == Algorithm::OpenFST::SMRReal
+   && join(' ', $real->distances('forward')) eq '1 2 2'
+   && $real->change_semiring(Algorithm::OpenFST::SMRLog) eq "$lattice",
+   'real semiring');
+
+my @kept = $costly->determinize(threshold => 0.5)->strings;
+my $over = eval { $costly->determinize(max_arcs => 2) };
+ok(!$over && $@ =~ /stopped early/
+   && $costly->determinize(max_arcs => 3)->NumStates == 3
+   && join('|', @kept) eq 'a b'
+   && join('|', sort $costly->determinize->strings) eq 'a b|b b',
+   'determinize budgets and threshold');
+
+my $wloop = Algorithm::OpenFST::from_list(0, [3, 4], \@syms,
+                                          [0, 1, 'a', 'a', 1],
+                                          [0, 2, 'b', 'b', 2],
+                                          [1, 3, 'a', 'a', 0.5],
+                                          [2, 4, 'a', 'a', 0.5],
+                                          [3, 1, 'b', 'b', 1],
+                                          [4, 2, 'b', 'b', 1]);
+sub first_paths
+{
+    my $it = shift->paths;
+    join '|', map {
+        my ($in, $out, $cost) = $it->next;
+        join('', @$in) . sprintf ':%.3f', $cost;
+    } 1 .. 5;
+}
+my ($pmin, $smin) = ($wloop->Minimize(2), $wloop->Minimize);
+ok($pmin->NumStates == 3 && $smin->NumStates == 3
+   && first_paths($pmin) eq first_paths($smin)
+   && first_paths($pmin) eq first_paths($wloop),
+   'parallel minimize matches Minimize');
+
+my $elb = Algorithm::OpenFST::lexicon_builder();
+$elb->add($_) for '', '', 'a';
+my $empty = $elb->finish;
+ok($empty->NumStates == 2 && join('|', sort $empty->strings) eq '|a',
+   'lexicon builder with the empty word');
+
+sub inverted_twice
+{
+    my $once = $_[0]->Invert;
+    ($once, "$_[0]");
+}
+my ($inv, $kept) = inverted_twice($lex->Copy);
+$copies = Algorithm::OpenFST::copy_count();
+my $joined = Algorithm::OpenFST::union($words[0]->Copy, @words[1, 2]);
+ok($kept eq "$lex" && "$inv" eq $lex->Invert
+   && Algorithm::OpenFST::copy_count() == $copies + 1
+   && "$joined" eq Algorithm::OpenFST::union(@words),
+   'sub arguments are not stolen');
+
+my $dup = Algorithm::OpenFST::from_list(0, 3, \@syms, [0, 1], [0, 2],
+                                        [1, 3, 'a', 'a'], [2, 3, 'a', 'a']);
+my $merged = $dup->RmEpsilon(1.024e-3, 2);
+ok("$merged" eq $dup->RmEpsilon && (() = "$merged" =~ /^0\t/mg) == 1,
+   'parallel RmEpsilon merges arcs');
+
+## (a|b)*a(a|b)^10 has 12 states, but its determinization has 2^11.
+my $blowup = Algorithm::OpenFST::from_list(
+    0, 11, \@syms, [0, 0, 'a', 'a'], [0, 0, 'b', 'b'], [0, 1, 'a', 'a'],
+    map { ([$_, $_ + 1, 'a', 'a'], [$_, $_ + 1, 'b', 'b']) } 1 .. 10);
+my $guess = $blowup->determinize_estimate(sample => 100);
+ok(!$guess->{complete} && $guess->{growth} > 1.5
+   && $guess->{predicted_states} > 1000 && $guess->{predicted_states} < 4000
+   && $blowup->determinize->NumStates == 2048,
+   'determinize_estimate sees exponential blowup');
+
+## Wider than the 256-state grain, so the threads really share levels
+## and buckets: start -> 600 middle states -> final, then with a loop.
+my $wide = Algorithm::OpenFST::VectorFST(Algorithm::OpenFST::SMRTropical);
+for (@syms) {
+    $wide->add_input_symbol($_);
+    $wide->add_output_symbol($_);
+}
+for my $i (1 .. 600) {
+    $wide->add_arc_safe(0, $i, 'a', 'a', $i % 2);
+    $wide->add_arc_safe($i, 601, 'b', 'b', $i % 5 / 2);
+}
+$wide->SetStart(0);
+$wide->SetFinal(601, 0);
+my $ring = $wide->Copy;
+$ring->add_arc_safe(601, 0, 'a', 'a', 1);
+sub same_distances
+{
+    my ($fst, $dir) = @_;
+    join(' ', $fst->Copy->distances($dir, 4))
+        eq join(' ', $fst->Copy->distances($dir));
+}
+ok(same_distances($wide, 'forward') && same_distances($wide, 'backward')
+   && same_distances($ring, 'forward') && same_distances($ring, 'backward'),
+   'parallel distances over wide levels and buckets');
+
+my $unknown = eval { $swap->transduce([qw(a c)]) };
+ok(!defined $unknown && $@ =~ /unknown input symbol 'c'/,
+   'unknown input symbols');
+
+## Probabilities are not costs, and need not sum over cycles.
+my $rloop = $loop->change_semiring(Algorithm::OpenFST::SMRReal);
+my @refused = grep { !eval { $_->(); 1 } && $@ =~ /log or tropical/ }
+    sub { $real->transduce([qw(a a)]) }, sub { $real->paths },
+    sub { $real->beam_search([qw(a a)]) },
+    sub { $real->decode_batch([[qw(a a)]]) },
+    sub { $real->ShortestPath(1, 0, 1) }, sub { $real->Prune(1) },
+    sub { $real->determinize(threshold => 1) };
+ok(@refused == 7 && !eval { $rloop->distances('forward') }
+   && $@ =~ /acyclic/ && !eval { $rloop->Copy->normalize; 1 }
+   && $real->best_paths(1)->semiring == Algorithm::OpenFST::SMRReal
+   && $rloop->prune(1)->semiring == Algorithm::OpenFST::SMRReal,
+   'real FSTs refuse cost-based searches');
+
+## Without $astar the library searches, from the cached distances.
+my @nbest = sort $trop->best_paths(2)->strings;
+ok(join('|', @nbest) eq 'a b|b b'
+   && join('|', sort $trop->best_paths(2, 0, 1)->strings) eq 'a b|b b'
+   && join('|', $trop->best_paths(1)->strings) eq 'a b',
+   'tropical n-best paths');
@@ -0,0 +1,107 @@
+#ifndef _threads_h
+#define _threads_h
+
+// Minimal pthread work sharing.  OpenFST is not thread-safe, so
+// anything run through here must only read shared FSTs (see
+// shared-fst.h) and write to its own outputs.
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+template <typename Fn>
+struct parallel_for_t
+{
+    struct worker
+    {
+        parallel_for_t * pf;
+        int id;
+    };
+
+    Fn& fn;
+    int n, grain, next;
+    bool failed;
+    string error;
+    pthread_mutex_t lock;
+
+    parallel_for_t(Fn& f, int _n, int g)
+        : fn(f), n(_n), grain(g), next(0), failed(false)
+        { pthread_mutex_init(&lock, NULL); }
+    ~parallel_for_t()
+        { pthread_mutex_destroy(&lock); }
+
+    /// Claim the next GRAIN items; false when there are none left.
+    bool claim(int& lo, int& hi)
+        {
+            pthread_mutex_lock(&lock);
+            lo = next;
+            next = failed || n - next <= grain ? n : next + grain;
+            hi = next;
+            pthread_mutex_unlock(&lock);
+            return lo < hi;
+        }
+
+    void fail(const char * what)
+        {
+            pthread_mutex_lock(&lock);
+            if (!failed)
+                error = what;
+            failed = true;
+            pthread_mutex_unlock(&lock);
+        }
+
+    static void * run(void * p)
+        {
+            worker * w = (worker *)p;
+            parallel_for_t * pf = w->pf;
+            int lo, hi;
+            while (pf->claim(lo, hi)) {
+                try {
+                    for (int i = lo; i < hi; i++)
+                        pf->fn(i, w->id);
+                } catch (std::exception& e) {
+                    pf->fail(e.what());
+                } catch (...) {
+                    pf->fail("unknown exception in worker thread");
+                }
+            }
+            return NULL;
+        }
+};
+
+/// Call FN(i, worker) for every i in [0, N) on up to NTHREADS threads,
+/// handing out GRAIN items at a time.  WORKER is in [0, NTHREADS), so
+/// FN can keep per-thread scratch space.  The calling thread does its
+/// share of the work.  If FN throws, remaining items are skipped and
+/// an fst_exception is thrown here once all threads have finished.
+template <typename Fn>
+void
+parallel_for(int n, int nthreads, Fn& fn, int grain = 1)
+{
+    if (grain < 1)
+        grain = 1;
+    if (nthreads > (n + grain - 1) / grain)
+        nthreads = (n + grain - 1) / grain;
+    if (nthreads < 1)
+        nthreads = 1;
+    parallel_for_t<Fn> pf(fn, n, grain);
+    vector<typename parallel_for_t<Fn>::worker> w(nthreads);
+    vector<pthread_t> tid(nthreads);
+    int started = 1;
+    for (int i = 0; i < nthreads; i++) {
+        w[i].pf = &pf;
+        w[i].id = i;
+    }
+    for (; started < nthreads; started++)
+        if (pthread_create(&tid[started], NULL,
+                           parallel_for_t<Fn>::run, &w[started]))
+            break;              // fine, fewer threads
+    parallel_for_t<Fn>::run(&w[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(tid[i], NULL);
+    if (pf.failed)
+        throw fst_exception(pf.error);
+}
+
+#endif // _threads_h